@@ -5,14 +5,76 @@
 #include <stdlib.h>
 #include <list>
 #include <pthread.h>
+#include <time.h>
 #include <iostream>
 #include "sql_connection_pool.h"
 
 using namespace std;
 
+//连接的空闲时间、借出的等待时间用单调时钟计算
+static long long now_us(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static long long now_ms(){
+    return now_us() / 1000;
+}
+
+//条件变量的超时是CLOCK_REALTIME的绝对时间
+static struct timespec deadline_after(long long ms){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    ts.tv_sec += ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+    return ts;
+}
+
+//线程本地缓存的连接：只有所属线程往槽里放，所属线程、等待连接的线程和后台线程都可以用原子交换取走，
+//谁换出非空指针连接就归谁。第一次使用时登记到连接池的m_slot_list
+struct thread_slots{
+    connection_pool *pool;
+    atomic<sql_conn *> conns[connection_pool::MAX_THREAD_SLOTS];
+    atomic<long long> since[connection_pool::MAX_THREAD_SLOTS];//放入槽的时间(毫秒)，后台线程据此判断空闲
+    atomic<long long> hits;
+
+    //线程退出时取消登记，把缓存的连接还给连接池
+    ~thread_slots(){
+        if(pool == NULL){
+            return;
+        }
+        pool->m_lock.lock();
+        pool->m_slot_list.remove(this);
+        pool->m_stats.local_hits += hits.load();
+        pool->m_lock.unlock();
+        for(int i = 0; i < connection_pool::MAX_THREAD_SLOTS; ++i){
+            sql_conn *conn = conns[i].exchange(NULL);
+            if(conn){
+                pool->give_back(conn, false);
+            }
+        }
+    }
+};
+static thread_local thread_slots t_slots;
+
 connection_pool::connection_pool(){
+    m_MinConn = 0;
+    m_MaxConn = 0;
     m_CurConn = 0;
     m_FreeConn = 0;
+    m_TotalConn = 0;
+    m_borrow_timeout_ms = 3000;
+    m_idle_timeout_ms = 60000;
+    m_ping_after_ms = 10000;
+    m_thread_slots = 0;
+    m_waiters = 0;
+    m_stop = false;
+    m_started = false;
+    m_close_log = 0;
+    memset(&m_stats, 0, sizeof(m_stats));
 }
 
 connection_pool *connection_pool::GetInstance(){
@@ -24,94 +86,470 @@ connection_pool::~connection_pool(){
     DestroyPool();
 }
 
+void connection_pool::set_timeouts(int borrow_timeout_ms, int idle_timeout_ms, int ping_after_ms){
+    m_borrow_timeout_ms = borrow_timeout_ms;
+    m_idle_timeout_ms = idle_timeout_ms;
+    m_ping_after_ms = ping_after_ms;
+}
+
+void connection_pool::set_thread_cache(int slots){
+    m_thread_slots = slots < 0 ? 0 : (slots > MAX_THREAD_SLOTS ? MAX_THREAD_SLOTS : slots);
+}
 
 void connection_pool::init(string url, string User, string PassWord, string DBName, int Port, int MaxConn, int close_log){
+    init(url, User, PassWord, DBName, Port, MaxConn / 4, MaxConn, close_log);
+}
+
+void connection_pool::init(string url, string User, string PassWord, string DBName, int Port, int MinConn, int MaxConn, int close_log){
     // 初始化数据库连接池的参数
 	m_url = url;
-	m_Port = Port;
+	m_Port = to_string(Port);
 	m_User = User;
 	m_PassWord = PassWord;
 	m_DatabaseName = DBName;
 	m_close_log = close_log;
+    m_MaxConn = MaxConn > 0 ? MaxConn : 1;
+    m_MinConn = MinConn < 1 ? 1 : (MinConn > m_MaxConn ? m_MaxConn : MinConn);
+    m_stop = false;
 
-    // 创建MaxConn个数据库连接
-    for(int i = 0; i < MaxConn; i++){
-        MYSQL *con = NULL;
-        con = mysql_init(con);
-
-        if(con == nullptr){
-            LOG_ERROR("MySQL Error: mysql_init");
-            exit(1);
-        }
-
-        // 尝试与数据库建立连接
-        con = mysql_real_connect(con, url.c_str(), User.c_str(), PassWord.c_str(), DBName.c_str(), Port, NULL, 0);
-
-        if(con == nullptr){
-            LOG_ERROR("MySQL Error: mysql_real_connect");
-            exit(1);
+    // 先建立MinConn个数据库连接；数据库暂时连不上也不退出，交给后台线程重连
+    for(int i = 0; i < m_MinConn; i++){
+        sql_conn *conn = new_conn();
+        if(conn == nullptr){
+            break;
         }
 
         // 将成功建立的连接添加到连接池中
-        connList.push_back(con);
+        m_lock.lock();
+        connList.push_back(conn);
         ++m_FreeConn;
+        ++m_TotalConn;
+        ++m_stats.connects;
+        m_lock.unlock();
+    }
+    if(m_TotalConn < m_MinConn){
+        LOG_ERROR("connection_pool: %d of %d connections up, retrying in background", m_TotalConn, m_MinConn);
+    }
+
+    if(pthread_create(&m_tid, NULL, worker, this) != 0){
+        LOG_ERROR("connection_pool: create thread failed");
+        return;
     }
-    
-    // 初始化信号量
-    reserve = sem(m_FreeConn);
-    m_MaxConn = m_FreeConn;
+    m_started = true;
+}
+
+sql_conn *connection_pool::new_conn(){
+    //连接连同它的预处理语句缓存一起分配，见sql_statement.h
+    sql_conn *conn = new sql_conn();
+    MYSQL *con = mysql_init(&conn->mysql);
+
+    if(con == nullptr){
+        LOG_ERROR("MySQL Error: mysql_init");
+        delete conn;
+        return NULL;
+    }
+
+    //建连和读写都设上限，数据库卡住时持有连接的线程最终会拿到错误返回
+    unsigned int connect_timeout = 3;
+    unsigned int rw_timeout = 5;
+    mysql_options(con, MYSQL_OPT_CONNECT_TIMEOUT, &connect_timeout);
+    mysql_options(con, MYSQL_OPT_READ_TIMEOUT, &rw_timeout);
+    mysql_options(con, MYSQL_OPT_WRITE_TIMEOUT, &rw_timeout);
+
+    // 尝试与数据库建立连接
+    if(mysql_real_connect(con, m_url.c_str(), m_User.c_str(), m_PassWord.c_str(), m_DatabaseName.c_str(),
+                          atoi(m_Port.c_str()), NULL, 0) == nullptr){
+        LOG_ERROR("MySQL Error: mysql_real_connect: %s", mysql_error(con));
+        mysql_close(con);
+        delete conn;
+        return NULL;
+    }
+    conn->last_used_ms = now_ms();
+    return conn;
+}
+
+void connection_pool::close_conn(sql_conn *conn){
+    sql_close_statements(&conn->mysql);
+    mysql_close(&conn->mysql);
+    delete conn;
 }
 
 
 //获取数据库连接
 MYSQL* connection_pool::GetConnection(){
-    if(0 == connList.size()){
-        return NULL;
+    return GetConnection(m_borrow_timeout_ms);
+}
+
+//先取本线程缓存的连接，不加锁；再取最近归还的空闲连接；没有空闲且未到上限时自己新建一个；
+//再从别的线程的槽里取；否则等到有连接归还或超时。timeout_ms小于0时一直等
+MYSQL* connection_pool::GetConnection(int timeout_ms){
+    if(m_thread_slots > 0 && t_slots.pool == this){
+        thread_slots &slots = t_slots;
+        for(int i = m_thread_slots - 1; i >= 0; --i){
+            sql_conn *conn = slots.conns[i].exchange(NULL);
+            if(conn == NULL){
+                continue;
+            }
+            if(now_ms() - conn->last_used_ms < m_ping_after_ms || mysql_ping(&conn->mysql) == 0){
+                slots.hits.fetch_add(1, memory_order_relaxed);
+                return &conn->mysql;
+            }
+            LOG_ERROR("MySQL Error: ping: %s", mysql_error(&conn->mysql));
+            give_back(conn, true);
+        }
     }
 
-    MYSQL *con = NULL;
-    reserve.wait();
+    long long start = now_us();
+    struct timespec deadline = deadline_after(timeout_ms > 0 ? timeout_ms : 0);
+    bool waited = false;
+    bool waiting = false;//已计入m_waiters
+    bool timed_out = false;
+    bool tried_connect = false;
 
     m_lock.lock();
-    con = connList.front();
-    connList.pop_front();
+    while(!m_stop){
+        sql_conn *conn = NULL;
+        if(!connList.empty()){
+            conn = connList.back();
+            connList.pop_back();
+            --m_FreeConn;
+        }
+        //数据库连不上时每次借用只试一次，之后等归还或后台线程重连成功
+        else if(m_TotalConn < m_MaxConn && !tried_connect){
+            tried_connect = true;
+            ++m_TotalConn;
+            m_lock.unlock();
+            conn = new_conn();
+            m_lock.lock();
+            if(conn){
+                ++m_stats.connects;
+            }
+            else{
+                --m_TotalConn;
+                ++m_stats.connect_fails;
+                m_wake.signal();
+            }
+        }
+        //链表空了且不能新建时，从其它线程的槽里取一个空闲连接；
+        //先计入m_waiters再取，ReleaseConnection放入槽后会再检查m_waiters，两边至少有一边看到对方
+        if(conn == NULL && m_thread_slots > 0){
+            if(!waiting){
+                waiting = true;
+                ++m_waiters;
+            }
+            conn = steal_locked();
+        }
+
+        if(conn){
+            if(waiting){
+                waiting = false;
+                --m_waiters;
+            }
+            ++m_CurConn;
+            if(now_ms() - conn->last_used_ms < m_ping_after_ms){
+                count_borrow(now_us() - start, waited);
+                m_lock.unlock();
+                return &conn->mysql;
+            }
+            m_lock.unlock();
+
+            // 空闲太久的连接可能已被服务端断开，借出前先确认
+            if(mysql_ping(&conn->mysql)){
+                LOG_ERROR("MySQL Error: ping: %s", mysql_error(&conn->mysql));
+                close_conn(conn);
+                m_lock.lock();
+                --m_CurConn;
+                --m_TotalConn;
+                ++m_stats.dropped;
+                tried_connect = false;
+                m_wake.signal();
+                continue;
+            }
 
-    --m_FreeConn;
-    ++m_CurConn;
+            m_lock.lock();
+            count_borrow(now_us() - start, waited);
+            m_lock.unlock();
+            return &conn->mysql;
+        }
+
+        if(timed_out){
+            break;
+        }
+        waited = true;
+        if(!waiting){
+            waiting = true;
+            ++m_waiters;
+        }
+        if(timeout_ms < 0){
+            m_free.wait(m_lock.get());
+        }
+        else if(!m_free.timewait(m_lock.get(), deadline)){
+            timed_out = true;
+        }
+    }
+    if(waiting){
+        --m_waiters;
+    }
+    if(!m_stop){
+        ++m_stats.timeouts;
+    }
     m_lock.unlock();
-    return con;
+    LOG_ERROR("connection_pool: no connection within %d ms", timeout_ms);
+    return NULL;
 }
 
 
+//持有m_lock时调用
+void connection_pool::count_borrow(long long wait_us, bool waited){
+    ++m_stats.borrows;
+    if(waited){
+        ++m_stats.waits;
+    }
+    m_stats.wait_us += wait_us;
+    if(wait_us > m_stats.max_wait_us){
+        m_stats.max_wait_us = wait_us;
+    }
+    if(m_CurConn > m_stats.peak_busy){
+        m_stats.peak_busy = m_CurConn;
+    }
+}
+
 //释放数据库连接
-bool connection_pool::ReleaseConnection(MYSQL *conn){
+bool connection_pool::ReleaseConnection(MYSQL *conn, bool broken){
     if(nullptr == conn){
         return false;
     }
 
-    m_lock.lock();
-    connList.push_back(conn);
+    sql_conn *c = (sql_conn *)conn;
+    broken = broken || sql_connection_lost(conn);
+    c->last_used_ms = now_ms();
+
+    if(!broken && m_thread_slots > 0){
+        thread_slots &slots = t_slots;
+        if(slots.pool == NULL){
+            m_lock.lock();
+            m_slot_list.push_back(&slots);
+            m_lock.unlock();
+            slots.pool = this;
+        }
+        if(m_waiters.load() == 0){
+            //别的线程只会把槽取空，看到非空的槽跳过即可
+            int i = 0;
+            while(i < m_thread_slots && slots.conns[i].load(memory_order_relaxed) != NULL){
+                ++i;
+            }
+            if(i < m_thread_slots){
+                slots.since[i].store(c->last_used_ms, memory_order_relaxed);
+                slots.conns[i].store(c);
+                if(m_waiters.load() == 0){
+                    return true;
+                }
+                //放入的同时有线程开始等待，已经被它取走就不用再还
+                if(slots.conns[i].exchange(NULL) == NULL){
+                    return true;
+                }
+            }
+        }
+        //有线程在等连接时，本线程缓存的连接全部交出去
+        if(m_waiters.load() > 0){
+            for(int i = 0; i < m_thread_slots; ++i){
+                sql_conn *old = slots.conns[i].exchange(NULL);
+                if(old){
+                    give_back(old, false);
+                }
+            }
+        }
+    }
+    give_back(c, broken);
+    return true;
+}
 
-    ++m_FreeConn;
+void connection_pool::give_back(sql_conn *c, bool broken){
+    m_lock.lock();
     --m_CurConn;
+    bool drop = broken || m_stop;
+    if(drop){
+        --m_TotalConn;
+        if(broken){
+            ++m_stats.dropped;
+            m_wake.signal();
+        }
+    }
+    else{
+        connList.push_back(c);
+        ++m_FreeConn;
+    }
+    //空出的名额也可以让等待者新建连接
+    m_free.signal();
     m_lock.unlock();
-    reserve.post();
-    return true;
+
+    if(drop){
+        close_conn(c);
+    }
 }
 
+//等待者从各线程的槽里取走一个连接；取走的连接先不算借出，调用者照常计数
+sql_conn *connection_pool::steal_locked(){
+    for(auto it = m_slot_list.begin(); it != m_slot_list.end(); ++it){
+        for(int i = 0; i < m_thread_slots; ++i){
+            sql_conn *conn = (*it)->conns[i].exchange(NULL);
+            if(conn){
+                --m_CurConn;
+                return conn;
+            }
+        }
+    }
+    return NULL;
+}
+
+//线程空闲下来后它的槽不会再被动到，由后台线程把空闲超时的连接收回：
+//连接数高于MinConn时放进closing由调用者关闭，否则放回链表
+void connection_pool::reap_slots_locked(long long now, list<sql_conn *> &closing){
+    for(auto it = m_slot_list.begin(); it != m_slot_list.end(); ++it){
+        thread_slots *slots = *it;
+        for(int i = 0; i < m_thread_slots; ++i){
+            sql_conn *conn = slots->conns[i].load();
+            if(conn == NULL || now - slots->since[i].load(memory_order_relaxed) < m_idle_timeout_ms){
+                continue;
+            }
+            if(!slots->conns[i].compare_exchange_strong(conn, NULL)){
+                continue;
+            }
+            //取到后连接归后台线程所有；槽里可能已换成刚归还的同一个连接，以连接自己的时间为准
+            --m_CurConn;
+            if(now - conn->last_used_ms < m_idle_timeout_ms){
+                connList.push_back(conn);
+                ++m_FreeConn;
+                m_free.signal();
+            }
+            else if(m_TotalConn > m_MinConn){
+                --m_TotalConn;
+                ++m_stats.reaped;
+                closing.push_back(conn);
+            }
+            else{
+                connList.push_front(conn);
+                ++m_FreeConn;
+                m_free.signal();
+            }
+        }
+    }
+}
+
+void *connection_pool::worker(void *arg){
+    ((connection_pool *)arg)->run();
+    return NULL;
+}
+
+//后台线程：连接数低于MinConn时重连补足，连不上时退避重试；
+//连接数高于MinConn时关闭空闲超过idle_timeout_ms的连接(链表头部是最久未用的)
+void connection_pool::run(){
+    long long backoff_ms = 0;
+    long long next_retry_ms = 0;
 
-void connection_pool::DestroyPool(){
     m_lock.lock();
-    if(connList.size() > 0){
-        for(auto it = connList.begin(); it != connList.end(); ++it){
-            MYSQL *con = *it;
-            mysql_close(con);
+    while(!m_stop){
+        long long now = now_ms();
+        if(m_TotalConn < m_MinConn && now >= next_retry_ms){
+            ++m_TotalConn;
+            m_lock.unlock();
+            sql_conn *conn = new_conn();
+            m_lock.lock();
+            if(conn){
+                connList.push_back(conn);
+                ++m_FreeConn;
+                ++m_stats.connects;
+                m_free.signal();
+                if(backoff_ms){
+                    LOG_INFO("connection_pool: database reconnected");
+                }
+                backoff_ms = 0;
+                continue;
+            }
+            --m_TotalConn;
+            ++m_stats.connect_fails;
+            backoff_ms = backoff_ms ? (backoff_ms * 2 > 30000 ? 30000 : backoff_ms * 2) : 500;
+            next_retry_ms = now_ms() + backoff_ms;
+        }
+
+        list<sql_conn *> closing;
+        if(m_thread_slots > 0){
+            reap_slots_locked(now, closing);
+        }
+        int reaped = closing.size();
+        if(!closing.empty()){
+            m_lock.unlock();
+            for(auto it = closing.begin(); it != closing.end(); ++it){
+                close_conn(*it);
+            }
+            m_lock.lock();
+        }
+        while(m_TotalConn > m_MinConn && !connList.empty() &&
+              now - connList.front()->last_used_ms >= m_idle_timeout_ms){
+            sql_conn *conn = connList.front();
+            connList.pop_front();
+            --m_FreeConn;
+            --m_TotalConn;
+            ++m_stats.reaped;
+            m_lock.unlock();
+            close_conn(conn);
+            m_lock.lock();
+            ++reaped;
+        }
+        if(reaped){
+            LOG_INFO("connection_pool: closed %d idle connections, %d left", reaped, m_TotalConn);
         }
-        m_CurConn = 0;
-        m_FreeConn = 0;
-        connList.clear();
+
+        long long wait_ms = 1000;
+        if(m_TotalConn < m_MinConn){
+            wait_ms = next_retry_ms - now_ms();
+            if(wait_ms < 1){
+                wait_ms = 1;
+            }
+        }
+        m_wake.timewait(m_lock.get(), deadline_after(wait_ms));
+    }
+    m_lock.unlock();
+}
+
+void connection_pool::GetStats(pool_stats *stats){
+    m_lock.lock();
+    *stats = m_stats;
+    stats->total = m_TotalConn;
+    stats->busy = m_CurConn;
+    stats->idle = m_FreeConn;
+    for(auto it = m_slot_list.begin(); it != m_slot_list.end(); ++it){
+        stats->local_hits += (*it)->hits.load(memory_order_relaxed);
+    }
+    m_lock.unlock();
+}
+
+//线程本地缓存的连接一起收回关闭，借出中的连接在归还时关闭
+void connection_pool::DestroyPool(){
+    m_lock.lock();
+    m_stop = true;
+    bool started = m_started;
+    m_started = false;
+    m_wake.signal();
+    m_free.broadcast();
+    m_lock.unlock();
+    if(started){
+        pthread_join(m_tid, NULL);
+    }
+
+    m_lock.lock();
+    list<sql_conn *> idle;
+    idle.swap(connList);
+    m_TotalConn -= m_FreeConn;
+    m_FreeConn = 0;
+    for(sql_conn *conn = steal_locked(); conn; conn = steal_locked()){
+        idle.push_back(conn);
+        --m_TotalConn;
     }
     m_lock.unlock();
+    for(auto it = idle.begin(); it != idle.end(); ++it){
+        close_conn(*it);
+    }
 }
 
 int connection_pool::GetFreeConn(){
@@ -120,7 +558,7 @@ int connection_pool::GetFreeConn(){
 
 connectionRAII::connectionRAII(MYSQL **SQL, connection_pool *connPool){
     *SQL = connPool->GetConnection();
-    
+
     conRAII = *SQL;
     poolRAII = connPool;
 }
@@ -128,7 +566,3 @@ connectionRAII::connectionRAII(MYSQL **SQL, connection_pool *connPool){
 connectionRAII::~connectionRAII(){
     poolRAII->ReleaseConnection(conRAII);
 }
-
-
-
-
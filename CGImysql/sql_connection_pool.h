@@ -1,5 +1,10 @@
-//懒汉+链表实现数据库连接池  
+//懒汉+链表实现数据库连接池
 //私有化它的构造函数和析构函数，以防止外界创建单例类的对象；使用类的私有静态指针变量指向类的唯一实例，并用一个公有的静态方法获取该实例。
+//连接数在[MinConn, MaxConn]之间伸缩：不够用时按需新建，空闲太久的关掉；
+//借连接最多等一个超时时间，数据库故障时请求变慢或失败，而不是把工作线程全部挂住；
+//后台线程负责补足最少连接数(断线重连)、回收空闲连接
+//可选的线程本地缓存：每个线程把归还的连接先留在自己的槽里，下次直接取用，不经过连接池的锁；
+//槽是原子指针，等待连接的线程和后台线程可以从别的线程的槽里取走空闲连接
 #ifndef _CONNECTION_POOL_
 #define _CONNECTION_POOL_
 
@@ -10,32 +15,91 @@
 #include <string.h>
 #include <iostream>
 #include <string>
+#include <pthread.h>
+#include <atomic>
 #include "../lock/locker.h"
 #include "../log/log.h"
+#include "sql_statement.h"
 
 using namespace std;
+
+//连接池统计，GetStats()取一份快照
+struct pool_stats{
+    int total;              //当前连接数(含正在建立的)
+    int busy;               //已借出
+    int idle;               //空闲
+    int peak_busy;          //借出数的峰值
+    long long borrows;      //成功借出次数
+    long long waits;        //借出前需要等待的次数
+    long long timeouts;     //等待超时次数
+    long long wait_us;      //借出累计等待时间(微秒)
+    long long max_wait_us;  //单次最长等待时间(微秒)
+    long long connects;     //新建连接成功次数
+    long long connect_fails;//新建连接失败次数
+    long long dropped;      //ping失败或归还时标记为坏的连接数
+    long long reaped;       //空闲超时被关闭的连接数
+    long long local_hits;   //从线程本地缓存借出的次数
+};
+
+struct thread_slots;
+
 class connection_pool{
+    friend struct thread_slots;
 public:
+    static const int MAX_THREAD_SLOTS = 4;
+
     static connection_pool *GetInstance();
 
-    /*初始化数据库连接池*/
-    void init(string url, string User, string PassWord, string DataBaseName, int Port, int MaxConn, int close_log); 
+    /*初始化数据库连接池，MaxConn为上限，最少保持MaxConn/4个*/
+    void init(string url, string User, string PassWord, string DataBaseName, int Port, int MaxConn, int close_log);
+    /*初始化数据库连接池，连接数在[MinConn, MaxConn]之间伸缩*/
+    void init(string url, string User, string PassWord, string DataBaseName, int Port, int MinConn, int MaxConn, int close_log);
+    //调整超时，init前调用：借连接最长等待、空闲多久回收、空闲多久借出前先ping(毫秒)
+    void set_timeouts(int borrow_timeout_ms, int idle_timeout_ms, int ping_after_ms);
+    //每个线程最多缓存slots个连接(不超过MAX_THREAD_SLOTS)，0关闭，init前调用；
+    //缓存的连接算作已借出，连接池没有空闲连接时等待者从各线程的槽里取，空闲超时的由后台线程收回
+    void set_thread_cache(int slots);
 
-    MYSQL *GetConnection();//获取数据库连接
-    bool ReleaseConnection(MYSQL *conn);//释放连接
+    MYSQL *GetConnection();//获取数据库连接，最多等待borrow_timeout_ms，超时返回NULL
+    MYSQL *GetConnection(int timeout_ms);//获取数据库连接，最多等待timeout_ms，超时返回NULL
+    bool ReleaseConnection(MYSQL *conn, bool broken = false);//释放连接，broken或连接已断开时直接关闭
     int GetFreeConn();//获取连接
+    void GetStats(pool_stats *stats);
     void DestroyPool();//销毁所有连接
 private:
     connection_pool();
     ~connection_pool();
+
+    sql_conn *new_conn();//新建一个连接，失败返回NULL
+    void close_conn(sql_conn *conn);
+    void give_back(sql_conn *conn, bool broken);//还回共享链表
+    sql_conn *steal_locked();//从线程本地缓存里取走一个连接，持有m_lock时调用
+    void reap_slots_locked(long long now, list<sql_conn *> &closing);//收回线程本地缓存中空闲超时的连接，持有m_lock时调用
+    void count_borrow(long long wait_us, bool waited);
+    static void *worker(void *arg);
+    void run();
 private:
+    int m_MinConn;//最少连接数
     int m_MaxConn;//最大连接数
     int m_FreeConn;//可用连接数
     int m_CurConn;//已用连接数
-    list<MYSQL *> connList;//连接池
- 
+    int m_TotalConn;//全部连接数，含正在建立的
+    list<sql_conn *> connList;//空闲连接，最近归还的在尾部
+
+    int m_borrow_timeout_ms;
+    int m_idle_timeout_ms;
+    int m_ping_after_ms;
+    int m_thread_slots;
+    atomic<int> m_waiters;//没有空闲连接、正在从线程本地缓存取或在条件变量上等待的线程数，大于0时线程本地缓存不再留连接
+    list<thread_slots *> m_slot_list;//用过线程本地缓存的线程，m_lock保护
+
     locker m_lock;
-    sem reserve;//信号量记录可用资源
+    cond m_free;//有连接归还或可以新建连接
+    cond m_wake;//唤醒后台线程
+    bool m_stop;
+    bool m_started;
+    pthread_t m_tid;
+    pool_stats m_stats;
 public:
     string m_url;//主机地址
     string m_Port;//数据库端口号
@@ -55,4 +119,4 @@ private:
     connection_pool *poolRAII;
 };
 
-#endif
\ No newline at end of file
+#endif
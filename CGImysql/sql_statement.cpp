@@ -0,0 +1,146 @@
+#include <mysql/mysql.h>
+#include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
+#include <string.h>
+#include "sql_statement.h"
+#include "sql_connection_pool.h"
+
+//下标即SQL_STMT
+static const char *stmt_sql[STMT_NUM] = {
+    "SELECT passwd FROM user WHERE username=? LIMIT 1",
+    "INSERT INTO user(username, passwd) VALUES(?, ?)",
+};
+
+bool sql_connection_lost(MYSQL *conn){
+    unsigned err = mysql_errno(conn);
+    return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+}
+
+//语句已失效(连接断开或服务端丢弃了语句)，重新预处理后可以再试一次
+static bool stale_statement(unsigned err){
+    return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST ||
+           err == ER_UNKNOWN_STMT_HANDLER || err == ER_NEED_REPREPARE;
+}
+
+static void bind_string(MYSQL_BIND *bind, std::string_view s, unsigned long *length){
+    *length = s.size();
+    bind->buffer_type = MYSQL_TYPE_STRING;
+    bind->buffer = (void *)s.data();
+    bind->buffer_length = s.size();
+    bind->length = length;
+}
+
+MYSQL_STMT *sql_get_statement(MYSQL *conn, SQL_STMT id){
+    sql_conn *c = (sql_conn *)conn;
+    unsigned long tid = mysql_thread_id(conn);
+    if(c->stmt_thread_id != tid){
+        sql_close_statements(conn);
+        c->stmt_thread_id = tid;
+    }
+    if(c->stmts[id]){
+        return c->stmts[id];
+    }
+
+    int m_close_log = connection_pool::GetInstance()->m_close_log;
+    MYSQL_STMT *stmt = mysql_stmt_init(conn);
+    if(!stmt){
+        LOG_ERROR("mysql_stmt_init error:%s", mysql_error(conn));
+        return NULL;
+    }
+    if(mysql_stmt_prepare(stmt, stmt_sql[id], strlen(stmt_sql[id]))){
+        LOG_ERROR("prepare error:%s", mysql_stmt_error(stmt));
+        mysql_stmt_close(stmt);
+        return NULL;
+    }
+    c->stmts[id] = stmt;
+    return stmt;
+}
+
+void sql_close_statements(MYSQL *conn){
+    sql_conn *c = (sql_conn *)conn;
+    for(int i = 0; i < STMT_NUM; ++i){
+        if(c->stmts[i]){
+            mysql_stmt_close(c->stmts[i]);
+            c->stmts[i] = NULL;
+        }
+    }
+}
+
+//绑定参数并执行，语句失效时重新预处理再试一次；返回已执行的语句，失败返回NULL并设置*err
+static MYSQL_STMT *execute(MYSQL *conn, SQL_STMT id, MYSQL_BIND *params, unsigned *err){
+    for(int attempt = 0; attempt < 2; ++attempt){
+        MYSQL_STMT *stmt = sql_get_statement(conn, id);
+        if(!stmt){
+            *err = mysql_errno(conn) ? mysql_errno(conn) : CR_SERVER_LOST;
+            return NULL;
+        }
+        if(mysql_stmt_bind_param(stmt, params) == 0 && mysql_stmt_execute(stmt) == 0){
+            return stmt;
+        }
+        *err = mysql_stmt_errno(stmt);
+        if(!stale_statement(*err)){
+            return NULL;
+        }
+        sql_close_statements(conn);
+    }
+    return NULL;
+}
+
+int sql_select_passwd(MYSQL *conn, std::string_view name, char *passwd, size_t cap, size_t *len){
+    int m_close_log = connection_pool::GetInstance()->m_close_log;
+    MYSQL_BIND param[1];
+    unsigned long name_len;
+    memset(param, 0, sizeof(param));
+    bind_string(&param[0], name, &name_len);
+
+    unsigned err = 0;
+    MYSQL_STMT *stmt = execute(conn, STMT_SELECT_PASSWD, param, &err);
+    if(!stmt){
+        LOG_ERROR("SELECT error:%u", err);
+        return -1;
+    }
+
+    MYSQL_BIND result[1];
+    unsigned long passwd_len = 0;
+    memset(result, 0, sizeof(result));
+    result[0].buffer_type = MYSQL_TYPE_STRING;
+    result[0].buffer = passwd;
+    result[0].buffer_length = cap;
+    result[0].length = &passwd_len;
+    if(mysql_stmt_bind_result(stmt, result) || mysql_stmt_store_result(stmt)){
+        LOG_ERROR("SELECT error:%s", mysql_stmt_error(stmt));
+        mysql_stmt_free_result(stmt);
+        return -1;
+    }
+
+    int ret;
+    int rc = mysql_stmt_fetch(stmt);
+    if(rc == MYSQL_NO_DATA){
+        ret = 0;
+    }
+    else if(rc == 0){
+        *len = passwd_len;
+        ret = 1;
+    }
+    else{
+        //MYSQL_DATA_TRUNCATED：库里的密码比缓冲区长
+        LOG_ERROR("SELECT fetch error:%d", rc);
+        ret = -1;
+    }
+    mysql_stmt_free_result(stmt);
+    return ret;
+}
+
+unsigned sql_insert_user(MYSQL *conn, std::string_view name, std::string_view passwd){
+    MYSQL_BIND param[2];
+    unsigned long name_len, passwd_len;
+    memset(param, 0, sizeof(param));
+    bind_string(&param[0], name, &name_len);
+    bind_string(&param[1], passwd, &passwd_len);
+
+    unsigned err = 0;
+    if(!execute(conn, STMT_INSERT_USER, param, &err)){
+        return err ? err : CR_SERVER_LOST;
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+//池中连接的预处理语句缓存
+//服务器只执行几条固定的SQL，每个池中连接第一次用到某条时预处理一次，之后只绑定参数执行，
+//服务端不再重复解析SQL，参数直接从string_view绑定，不拼接字符串，也就不存在注入
+//断线重连后连接线程号会变化，旧语句随之失效，下次取用时自动重新预处理
+#ifndef _SQL_STATEMENT_
+#define _SQL_STATEMENT_
+
+#include <mysql/mysql.h>
+#include <stddef.h>
+#include <string_view>
+
+enum SQL_STMT{
+    STMT_SELECT_PASSWD = 0,  //SELECT passwd FROM user WHERE username=?
+    STMT_INSERT_USER,        //INSERT INTO user(username, passwd) VALUES(?, ?)
+    STMT_NUM
+};
+
+//池中的连接：MYSQL是第一个成员，GetConnection()返回的MYSQL*可以直接转换回sql_conn*
+struct sql_conn{
+    MYSQL mysql;
+    MYSQL_STMT *stmts[STMT_NUM];
+    unsigned long stmt_thread_id;  //预处理语句所属的连接线程号
+    long long last_used_ms;        //最近一次归还连接池的时间(单调时钟)，空闲太久的借出前先ping
+};
+
+//以下函数只能用于连接池创建的连接，且只由当前持有该连接的线程调用
+
+//取语句，第一次使用或重连后重新预处理；失败返回NULL
+MYSQL_STMT *sql_get_statement(MYSQL *conn, SQL_STMT id);
+//关闭连接上所有已预处理的语句
+void sql_close_statements(MYSQL *conn);
+//最近一次调用是否因为连接断开而失败，这样的连接不能再放回连接池
+bool sql_connection_lost(MYSQL *conn);
+
+//查询用户密码：1找到，0不存在，-1出错
+int sql_select_passwd(MYSQL *conn, std::string_view name, char *passwd, size_t cap, size_t *len);
+//插入用户：成功返回0，否则返回错误码，重名为ER_DUP_ENTRY
+unsigned sql_insert_user(MYSQL *conn, std::string_view name, std::string_view passwd);
+
+#endif
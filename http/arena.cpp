@@ -0,0 +1,33 @@
+#include "arena.h"
+
+//当前块放不下：借一个能放下的新块，旧块留在链表中，等reset()时一起归还
+void *arena::alloc_slow(size_t size, size_t align)
+{
+    size_t need = sizeof(block) + size + align;
+    size_t block_size = need < (size_t)buffer_pool::MIN_BLOCK ? (size_t)buffer_pool::MIN_BLOCK : need;
+    char *mem = buffer_pool::get_instance()->alloc(block_size);
+    if (!mem)
+        return NULL;
+
+    block *b = (block *)mem;
+    b->next = m_head;
+    b->size = block_size;
+    m_head = b;
+    m_bytes += block_size;
+    m_ptr = mem + sizeof(block);
+    m_end = mem + block_size;
+    return alloc(size, align);
+}
+
+void arena::reset()
+{
+    while (m_head)
+    {
+        block *next = m_head->next;
+        buffer_pool::get_instance()->free((char *)m_head, m_head->size);
+        m_head = next;
+    }
+    m_ptr = NULL;
+    m_end = NULL;
+    m_bytes = 0;
+}
@@ -0,0 +1,66 @@
+//请求级的bump指针分配器：每个连接一个，不逐个释放，请求结束时reset()整体归还；内存块从buffer_pool借用
+//目前只有两处使用：多段Range响应的分段头和上传的目标/暂存路径。请求解析(header_table)、路由、
+//表单解码(form_decoder)和响应构造(response_builder)本身不在堆上分配，不经过这里
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <string.h>
+#include "read_buffer.h"
+
+class arena
+{
+public:
+    arena() : m_head(NULL), m_ptr(NULL), m_end(NULL), m_bytes(0) {}
+    ~arena() { reset(); }
+
+    //分配size字节，按align对齐；超过buffer_pool最大块时返回NULL
+    void *alloc(size_t size, size_t align = alignof(max_align_t))
+    {
+        size_t pad = (align - ((size_t)m_ptr & (align - 1))) & (align - 1);
+        if (m_ptr && size + pad <= (size_t)(m_end - m_ptr))
+        {
+            char *p = m_ptr + pad;
+            m_ptr = p + size;
+            return p;
+        }
+        return alloc_slow(size, align);
+    }
+
+    //复制n字节并补'\0'
+    char *strdup(const char *s, size_t n)
+    {
+        char *p = (char *)alloc(n + 1, 1);
+        if (p)
+        {
+            memcpy(p, s, n);
+            p[n] = '\0';
+        }
+        return p;
+    }
+    char *strdup(const char *s) { return strdup(s, strlen(s)); }
+
+    //归还全部内存块，之前分配的指针全部失效
+    void reset();
+
+    //当前借用的字节数
+    size_t capacity() const { return m_bytes; }
+
+private:
+    arena(const arena &);
+    arena &operator=(const arena &);
+    void *alloc_slow(size_t size, size_t align);
+
+    //块头放在块的开头，块之间单向链接
+    struct block
+    {
+        block *next;
+        size_t size;
+    };
+    block *m_head;  //最近借用的块
+    char *m_ptr;    //当前块中下一个可用位置
+    char *m_end;    //当前块末尾
+    size_t m_bytes;
+};
+
+#endif
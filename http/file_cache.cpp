@@ -0,0 +1,447 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <stdio.h>
+#include <time.h>
+#include <zlib.h>
+#include <string.h>
+#include <strings.h>
+#include "file_cache.h"
+
+//会改变文件内容或让路径指向别的文件的事件
+static const uint32_t WATCH_MASK = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+
+int file_cache::m_max_age = 0;
+int file_cache::m_compress_level = 6;
+long file_cache::m_compress_min_size = 1024;
+long file_cache::m_compress_max_size = 1024 * 1024;
+
+file_cache::file_cache()
+    : m_bytes(0), m_byte_budget(64 * 1024 * 1024), m_max_entries(1024)
+{
+    m_inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (m_inotify_fd >= 0)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, watch_thread, this) != 0)
+        {
+            close(m_inotify_fd);
+            m_inotify_fd = -1;
+        }
+        else
+            pthread_detach(tid);
+    }
+}
+
+file_cache::~file_cache()
+{
+    m_lock.wrlock();
+    while (!m_lru.empty())
+        unlink_locked(m_lru.back());
+    m_lock.unlock();
+}
+
+void file_cache::init(size_t byte_budget, int max_entries)
+{
+    m_lock.wrlock();
+    m_byte_budget = byte_budget;
+    m_max_entries = max_entries;
+    evict_locked();
+    m_lock.unlock();
+}
+
+//同一个文件且内容、属性都没有变过
+static bool same_file(const struct stat &a, const struct stat &b)
+{
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size &&
+           a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec &&
+           a.st_ctim.tv_sec == b.st_ctim.tv_sec && a.st_ctim.tv_nsec == b.st_ctim.tv_nsec;
+}
+
+file_entry *file_cache::acquire(const char *path)
+{
+    m_lock.rdlock();
+    auto it = m_map.find(std::string_view(path));
+    if (it != m_map.end())
+    {
+        //命中：增加引用，标记最近使用过；不移动LRU表，读锁下的命中可以并行
+        file_entry *entry = it->second;
+        entry->refcnt.fetch_add(1, std::memory_order_relaxed);
+        //已经置位的不再写，减少缓存行失效
+        if (!entry->referenced.load(std::memory_order_relaxed))
+            entry->referenced.store(true, std::memory_order_relaxed);
+        m_lock.unlock();
+        return entry;
+    }
+    m_lock.unlock();
+
+    //未命中：锁外完成stat/open，避免慢速文件系统阻塞其他线程的命中路径
+    file_entry *entry = load(path);
+    if (!entry)
+        return NULL;
+
+    //只缓存普通文件，且要能被监听到变化
+    bool cacheable = m_inotify_fd >= 0 && entry->fd >= 0 && (size_t)entry->st.st_size <= m_byte_budget;
+    if (!cacheable)
+        return entry;
+
+    m_lock.wrlock();
+    it = m_map.find(std::string_view(entry->path));
+    if (it != m_map.end())
+    {
+        //其他线程已经装入了同一文件，用它的条目
+        file_entry *exist = it->second;
+        exist->refcnt.fetch_add(1, std::memory_order_relaxed);
+        m_lock.unlock();
+        destroy(entry);
+        return exist;
+    }
+
+    entry->wd = inotify_add_watch(m_inotify_fd, entry->path.c_str(), WATCH_MASK);
+    if (entry->wd < 0)
+    {
+        m_lock.unlock();
+        return entry;
+    }
+    //同一inode的另一条路径(硬链接、多余的'/')会拿到同一个wd，两个条目都有效，共用这个watch
+    entry->cached = true;
+    entry->refcnt.fetch_add(1, std::memory_order_relaxed);
+    m_lru.push_front(entry);
+    entry->lru_it = m_lru.begin();
+    m_map[std::string_view(entry->path)] = entry;
+    m_watch.emplace(entry->wd, entry);
+    m_bytes += entry->charged;
+    evict_locked();
+    m_lock.unlock();
+
+    //load()在watch建立之前完成，这期间的修改不会产生事件；watch已经登记，
+    //之后的修改都会让条目失效，这里再stat一次补上之前的空档
+    struct stat st;
+    if (stat(entry->path.c_str(), &st) < 0 || !same_file(st, entry->st))
+    {
+        m_lock.wrlock();
+        unlink_locked(entry);
+        m_lock.unlock();
+    }
+    return entry;
+}
+
+void file_cache::release(file_entry *entry)
+{
+    if (entry)
+        unref(entry);
+}
+
+//值得压缩的文本类型，图片、视频等本身已压缩的格式不在其中
+static bool compressible_type(const std::string &path)
+{
+    static const char *exts[] = {".html", ".htm", ".css", ".js", ".json", ".svg", ".txt", ".xml"};
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos)
+        return false;
+    for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); ++i)
+    {
+        if (strcasecmp(path.c_str() + dot, exts[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+//预压缩文件必须是可读的普通文件，且不早于原文件，避免原文件更新后发出旧内容
+static bool sidecar_usable(const file_entry *entry, const char *suffix)
+{
+    std::string path = entry->path + suffix;
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0)
+        return false;
+    return S_ISREG(st.st_mode) && (st.st_mode & S_IROTH) && st.st_mtime >= entry->st.st_mtime;
+}
+
+//stat并打开文件，非普通文件或不可读的文件只返回状态
+file_entry *file_cache::load(const char *path)
+{
+    file_entry *entry = new file_entry;
+    entry->path = path;
+    entry->fd = -1;
+    entry->addr.store(NULL, std::memory_order_relaxed);
+    entry->refcnt.store(1, std::memory_order_relaxed);
+    entry->referenced.store(false, std::memory_order_relaxed);
+    entry->cached = false;
+    entry->wd = -1;
+    for (int i = 0; i < 4; ++i)
+        entry->response_ready[i].store(false, std::memory_order_relaxed);
+    for (int i = 0; i < COMPRESS_CODING_NUM; ++i)
+        entry->compressed_ready[i].store(false, std::memory_order_relaxed);
+
+    if (stat(path, &entry->st) < 0)
+    {
+        delete entry;
+        return NULL;
+    }
+    if (S_ISREG(entry->st.st_mode) && (entry->st.st_mode & S_IROTH))
+    {
+        entry->fd = open(path, O_RDONLY | O_CLOEXEC);
+        //打开前后文件可能被替换，以fd上的状态为准
+        if (entry->fd >= 0)
+            fstat(entry->fd, &entry->st);
+    }
+
+    //记录可用的预压缩版本，命中时不再为查找它们stat
+    entry->sidecars = 0;
+    if (entry->fd >= 0)
+    {
+        if (sidecar_usable(entry, ".gz"))
+            entry->sidecars |= SIDECAR_GZIP;
+        if (sidecar_usable(entry, ".br"))
+            entry->sidecars |= SIDECAR_BR;
+    }
+
+    entry->compressible.store(entry->fd >= 0 && entry->st.st_size >= m_compress_min_size &&
+                              entry->st.st_size <= m_compress_max_size && compressible_type(entry->path),
+                              std::memory_order_relaxed);
+    entry->charged = entry->st.st_size;
+
+    //验证器只依赖文件状态，装入时生成一次，命中时直接使用
+    snprintf(entry->etag, sizeof(entry->etag), "\"%lx-%lx-%lx\"",
+             (unsigned long)entry->st.st_ino, (unsigned long)entry->st.st_mtime, (unsigned long)entry->st.st_size);
+    struct tm tm;
+    gmtime_r(&entry->st.st_mtime, &tm);
+    strftime(entry->last_modified, sizeof(entry->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return entry;
+}
+
+char *file_cache::mapping(file_entry *entry)
+{
+    char *addr = entry->addr.load(std::memory_order_acquire);
+    if (addr || entry->fd < 0 || entry->st.st_size == 0)
+        return addr;
+
+    entry->lock.lock();
+    addr = entry->addr.load(std::memory_order_relaxed);
+    if (!addr)
+    {
+        void *p = mmap(0, entry->st.st_size, PROT_READ, MAP_SHARED, entry->fd, 0);
+        if (p != MAP_FAILED)
+        {
+            addr = (char *)p;
+            entry->addr.store(addr, std::memory_order_release);
+        }
+    }
+    entry->lock.unlock();
+    return addr;
+}
+
+const std::string *file_cache::full_response(file_entry *entry, bool keep_alive, const char *encoding)
+{
+    if (entry->fd < 0 || entry->st.st_size == 0)
+        return NULL;
+
+    int idx = (keep_alive ? 1 : 0) | (encoding ? 2 : 0);
+    std::string *resp = &entry->response[idx];
+    if (entry->response_ready[idx].load(std::memory_order_acquire))
+        return resp;
+
+    //不持有任何锁读文件；并发的首次请求可能各读一遍，只有第一个结果被留下
+    //头部格式与http_conn::process_write一致；有多种编码版本的文件都要带Vary
+    char coding[96] = "";
+    if (encoding)
+        snprintf(coding, sizeof(coding), "Content-Encoding:%s\r\nVary:Accept-Encoding\r\n", encoding);
+    else if (entry->sidecars || entry->compressible)
+        snprintf(coding, sizeof(coding), "Vary:Accept-Encoding\r\n");
+
+    char head[384];
+    int head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.1 200 OK\r\nAccept-Ranges:bytes\r\n%sETag:%s\r\nLast-Modified:%s\r\nCache-Control:max-age=%d\r\n"
+                            "Content-Length:%ld\r\nConnection:%s\r\n\r\n",
+                            coding, entry->etag, entry->last_modified, m_max_age,
+                            (long)entry->st.st_size, keep_alive ? "keep-alive" : "close");
+    std::string buf(head, head_len);
+    buf.resize(head_len + entry->st.st_size);
+    if (pread(entry->fd, &buf[head_len], entry->st.st_size, 0) != entry->st.st_size)
+        return NULL;
+
+    size_t added = 0;
+    entry->lock.lock();
+    if (!entry->response_ready[idx].load(std::memory_order_relaxed))
+    {
+        resp->swap(buf);
+        entry->response_ready[idx].store(true, std::memory_order_release);
+        added = resp->size();
+    }
+    entry->lock.unlock();
+    charge(entry, added);
+    return resp;
+}
+
+const std::string *file_cache::compressed(file_entry *entry, int coding)
+{
+    if (!entry->compressible.load(std::memory_order_relaxed))
+        return NULL;
+    if (entry->compressed_ready[coding].load(std::memory_order_acquire))
+        return &entry->compressed[coding];
+
+    m_lock.rdlock();
+    bool cached = entry->cached;
+    m_lock.unlock();
+    //只压缩缓存中的文件，否则压缩结果无处复用，每个请求都要付一次CPU
+    if (!cached)
+        return NULL;
+
+    char *addr = mapping(entry);
+    if (!addr)
+        return NULL;
+
+    //锁外压缩；windowBits加16输出gzip格式，否则为zlib格式(HTTP的deflate编码)
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    int window_bits = coding == COMPRESS_GZIP ? 15 + 16 : 15;
+    if (deflateInit2(&zs, m_compress_level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return NULL;
+    std::string out;
+    out.resize(deflateBound(&zs, entry->st.st_size) + 32);
+    zs.next_in = (Bytef *)addr;
+    zs.avail_in = entry->st.st_size;
+    zs.next_out = (Bytef *)&out[0];
+    zs.avail_out = out.size();
+    int rc = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    //压缩后没有变小的不值得发送，标记后不再尝试
+    if (rc != Z_STREAM_END || out.size() >= (size_t)entry->st.st_size)
+    {
+        entry->compressible.store(false, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    size_t added = 0;
+    entry->lock.lock();
+    if (!entry->compressed_ready[coding].load(std::memory_order_relaxed))
+    {
+        static const char *suffix[COMPRESS_CODING_NUM] = {"gz", "df"};
+        //压缩版本是另一种表示，ETag在原ETag的引号内追加编码后缀
+        snprintf(entry->compressed_etag[coding], sizeof(entry->compressed_etag[coding]), "%.*s-%s\"",
+                 (int)strlen(entry->etag) - 1, entry->etag, suffix[coding]);
+        entry->compressed[coding].swap(out);
+        entry->compressed_ready[coding].store(true, std::memory_order_release);
+        added = entry->compressed[coding].size();
+    }
+    entry->lock.unlock();
+    charge(entry, added);
+    return &entry->compressed[coding];
+}
+
+//条目上新生成的内容计入缓存预算，超出时淘汰；
+//调用者持有引用，淘汰掉本条目也不会销毁它
+void file_cache::charge(file_entry *entry, size_t bytes)
+{
+    if (!bytes)
+        return;
+    m_lock.wrlock();
+    if (entry->cached)
+    {
+        entry->charged += bytes;
+        m_bytes += bytes;
+        evict_locked();
+    }
+    m_lock.unlock();
+}
+
+//CLOCK：表尾的条目最近被命中过就清掉标记移到表头，再给一次机会，否则淘汰；
+//写锁下没有并发的命中，每个条目最多被跳过一次，循环一定结束
+void file_cache::evict_locked()
+{
+    while (!m_lru.empty() && (m_bytes > m_byte_budget || (int)m_map.size() > m_max_entries))
+    {
+        file_entry *victim = m_lru.back();
+        if (victim->referenced.exchange(false, std::memory_order_relaxed))
+        {
+            m_lru.splice(m_lru.begin(), m_lru, victim->lru_it);
+            continue;
+        }
+        unlink_locked(victim);
+    }
+}
+
+//从缓存中摘除，仍被连接引用的条目等最后一个release时再销毁
+void file_cache::unlink_locked(file_entry *entry)
+{
+    if (!entry->cached)
+        return;
+    entry->cached = false;
+    m_map.erase(std::string_view(entry->path));
+    m_lru.erase(entry->lru_it);
+    m_bytes -= entry->charged;
+    if (entry->wd >= 0)
+    {
+        //共用wd的条目都摘除后才移除watch，否则剩下的条目收不到事件，
+        //随后的IN_IGNORED还会把它们一起失效
+        bool shared = false;
+        auto range = m_watch.equal_range(entry->wd);
+        for (auto it = range.first; it != range.second;)
+        {
+            if (it->second == entry)
+                it = m_watch.erase(it);
+            else
+            {
+                shared = true;
+                ++it;
+            }
+        }
+        if (!shared)
+            inotify_rm_watch(m_inotify_fd, entry->wd);
+        entry->wd = -1;
+    }
+    unref(entry);
+}
+
+//引用计数归零时只剩当前线程能看到这个条目，不需要加锁
+void file_cache::unref(file_entry *entry)
+{
+    if (entry->refcnt.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        destroy(entry);
+}
+
+void file_cache::destroy(file_entry *entry)
+{
+    char *addr = entry->addr.load(std::memory_order_relaxed);
+    if (addr)
+        munmap(addr, entry->st.st_size);
+    if (entry->fd >= 0)
+        close(entry->fd);
+    delete entry;
+}
+
+void *file_cache::watch_thread(void *arg)
+{
+    ((file_cache *)arg)->watch_loop();
+    return NULL;
+}
+
+void file_cache::watch_loop()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true)
+    {
+        ssize_t len = read(m_inotify_fd, buf, sizeof(buf));
+        if (len <= 0)
+        {
+            if (len < 0 && errno == EINTR)
+                continue;
+            break;
+        }
+
+        m_lock.wrlock();
+        for (char *p = buf; p < buf + len;)
+        {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            //同一文件的所有路径一起失效，unlink_locked会从m_watch中删掉对应的项
+            for (auto it = m_watch.find(ev->wd); it != m_watch.end(); it = m_watch.find(ev->wd))
+                unlink_locked(it->second);
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+        m_lock.unlock();
+    }
+}
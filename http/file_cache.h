@@ -0,0 +1,117 @@
+//进程级的静态文件缓存：按真实路径缓存 struct stat、打开的fd和只读映射
+//命中时只在读锁下做一次哈希查找和原子引用计数，不再有stat/open/mmap/munmap系统调用，归还不加锁
+//按字节预算以CLOCK(近似LRU)淘汰，用inotify监听缓存中的文件，文件变化时立即失效
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+//预压缩的旁路文件：foo.html.gz / foo.html.br
+enum SIDECAR
+{
+    SIDECAR_GZIP = 1,
+    SIDECAR_BR = 2
+};
+
+//运行时压缩的编码
+enum COMPRESS_CODING
+{
+    COMPRESS_GZIP = 0,
+    COMPRESS_DEFLATE,
+    COMPRESS_CODING_NUM
+};
+
+struct file_entry
+{
+    std::string path;     //真实路径，也是哈希表键的存储
+    struct stat st;       //文件状态
+    int fd;               //只读打开的fd，sendfile使用；非普通文件为-1
+    std::atomic<char *> addr;     //整个文件的只读映射，按需建立；空文件为NULL
+    std::atomic<int> refcnt;      //引用计数，缓存本身持有一个引用
+    std::atomic<bool> referenced; //命中时置位，淘汰时据此给一次机会
+    bool cached;          //是否仍在缓存中，由缓存的锁保护
+    int wd;               //inotify watch描述符
+    char etag[64];            //强ETag，由inode、mtime和大小生成，含双引号
+    char last_modified[32];   //mtime的HTTP日期
+    int sidecars;             //旁边存在且不旧于本文件的预压缩文件，SIDECAR_GZIP/SIDECAR_BR按位或
+    std::atomic<bool> compressible;  //文本类型且大小在压缩阈值内，可以在运行时压缩
+    //以下内容按需生成，生成时持有lock，生成后置位对应的ready，读取时先检查ready，不加锁
+    locker lock;
+    //预先生成的完整200响应，下标 = keep-alive(1) | 作为压缩版本发送(2)
+    std::string response[4];
+    std::atomic<bool> response_ready[4];
+    //运行时压缩的结果及其ETag，按COMPRESS_CODING索引，首次请求时生成
+    std::string compressed[COMPRESS_CODING_NUM];
+    char compressed_etag[COMPRESS_CODING_NUM][72];
+    std::atomic<bool> compressed_ready[COMPRESS_CODING_NUM];
+    size_t charged;           //计入缓存预算的字节数：文件大小 + 预置响应 + 压缩结果，由缓存的锁保护
+    std::list<file_entry *>::iterator lru_it;
+};
+
+class file_cache
+{
+public:
+    static file_cache *get_instance()
+    {
+        static file_cache instance;
+        return &instance;
+    }
+
+    //设置缓存容量：映射/文件字节预算与最多缓存的文件数(即常驻fd数)
+    void init(size_t byte_budget, int max_entries);
+
+    //获取path对应的条目，文件不存在返回NULL；返回的条目必须用release()归还
+    file_entry *acquire(const char *path);
+    void release(file_entry *entry);
+
+    //返回条目的只读映射，首次使用时才建立；失败或空文件返回NULL
+    char *mapping(file_entry *entry);
+
+    //返回"状态行+头部+文件内容"连续存放的完整200响应，首次使用时生成，只用于小文件
+    //Connection头随请求变化；encoding非NULL表示该条目作为预压缩版本发送，带Content-Encoding；失败返回NULL
+    const std::string *full_response(file_entry *entry, bool keep_alive, const char *encoding);
+
+    //返回条目按coding压缩后的内容，同一文件只压缩一次；条目不在缓存中或不可压缩时返回NULL
+    const std::string *compressed(file_entry *entry, int coding);
+
+    //生成预置响应时使用的Cache-Control max-age(秒)
+    static int m_max_age;
+    //运行时压缩的zlib级别，以及参与压缩的文件大小范围
+    static int m_compress_level;
+    static long m_compress_min_size;
+    static long m_compress_max_size;
+
+private:
+    file_cache();
+    ~file_cache();
+
+    file_entry *load(const char *path);
+    void evict_locked();
+    void charge(file_entry *entry, size_t bytes);
+    void unlink_locked(file_entry *entry);
+    static void unref(file_entry *entry);
+    static void destroy(file_entry *entry);
+
+    //inotify线程：文件被修改、删除、移动或属性变化时让对应条目失效
+    static void *watch_thread(void *arg);
+    void watch_loop();
+
+private:
+    std::unordered_map<std::string_view, file_entry *> m_map;
+    std::unordered_multimap<int, file_entry *> m_watch;  //inotify wd -> 条目，同一inode的多条路径共用一个wd
+    std::list<file_entry *> m_lru;                  //表头为最近装入或得到第二次机会的条目
+    size_t m_bytes;        //缓存条目计入预算的总字节数
+    size_t m_byte_budget;  //字节预算
+    int m_max_entries;     //条目数上限
+    int m_inotify_fd;      //-1表示inotify不可用，此时不缓存
+    rwlocker m_lock;       //命中只加读锁；装入、淘汰、失效加写锁
+};
+
+#endif
@@ -0,0 +1,202 @@
+#include <string.h>
+#include <strings.h>
+#include "form_decoder.h"
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+//就地解码[p, p + len)：'+'为空格，%XX为一个字节；解码结果不会比原文长；非法转义返回-1
+static long url_decode(char *p, size_t len)
+{
+    char *out = p;
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (p[i] == '+')
+            *out++ = ' ';
+        else if (p[i] == '%')
+        {
+            if (i + 2 >= len)
+                return -1;
+            int hi = hex_value(p[i + 1]), lo = hex_value(p[i + 2]);
+            if (hi < 0 || lo < 0)
+                return -1;
+            *out++ = (char)(hi << 4 | lo);
+            i += 2;
+        }
+        else
+            *out++ = p[i];
+    }
+    return out - p;
+}
+
+FORM_STATUS form_decoder::add(std::string_view name, std::string_view value, std::string_view filename)
+{
+    if (m_count >= MAX_FIELDS || name.size() > m_max_value || value.size() > m_max_value)
+        return FORM_TOO_LARGE;
+    m_fields[m_count].name = name;
+    m_fields[m_count].value = value;
+    m_fields[m_count].filename = filename;
+    ++m_count;
+    return FORM_OK;
+}
+
+FORM_STATUS form_decoder::parse(char *body, size_t len, std::string_view content_type)
+{
+    //没有Content-Type时按表单的默认编码处理
+    const char *type = content_type.data();
+    size_t type_len = content_type.size();
+    if (!type || type_len == 0 || (type_len >= 33 && strncasecmp(type, "application/x-www-form-urlencoded", 33) == 0))
+        return parse_urlencoded(body, len);
+    if (type_len < 19 || strncasecmp(type, "multipart/form-data", 19) != 0)
+        return FORM_BAD;
+
+    //boundary参数，可能带引号
+    for (size_t i = 19; i + 9 <= type_len; ++i)
+    {
+        if (strncasecmp(type + i, "boundary=", 9) != 0)
+            continue;
+        std::string_view b = content_type.substr(i + 9);
+        if (!b.empty() && b[0] == '"')
+        {
+            size_t end = b.find('"', 1);
+            if (end == std::string_view::npos)
+                return FORM_BAD;
+            b = b.substr(1, end - 1);
+        }
+        else
+            b = b.substr(0, b.find_first_of("; \t"));
+        return parse_multipart(body, len, b);
+    }
+    return FORM_BAD;
+}
+
+//name=value&name=value，名字和值分别解码
+FORM_STATUS form_decoder::parse_urlencoded(char *body, size_t len)
+{
+    m_count = 0;
+    size_t pos = 0;
+    while (pos < len)
+    {
+        char *pair = body + pos;
+        char *amp = (char *)memchr(pair, '&', len - pos);
+        size_t pair_len = amp ? (size_t)(amp - pair) : len - pos;
+        pos += pair_len + 1;
+        if (pair_len == 0)
+            continue;
+
+        char *eq = (char *)memchr(pair, '=', pair_len);
+        size_t name_len = eq ? (size_t)(eq - pair) : pair_len;
+        char *value = eq ? eq + 1 : pair + pair_len;
+        size_t value_len = eq ? pair_len - name_len - 1 : 0;
+        //原文都超过上限时解码后也可能超过，先做粗略检查，避免无谓的解码
+        if (name_len > 3 * m_max_value || value_len > 3 * m_max_value)
+            return FORM_TOO_LARGE;
+
+        long n = url_decode(pair, name_len);
+        long v = url_decode(value, value_len);
+        if (n < 0 || v < 0)
+            return FORM_BAD;
+        FORM_STATUS ret = add(std::string_view(pair, n), std::string_view(value, v), std::string_view());
+        if (ret != FORM_OK)
+            return ret;
+    }
+    return FORM_OK;
+}
+
+//从Content-Disposition头中取出key="..."的值
+static std::string_view disposition_param(std::string_view line, const char *key)
+{
+    size_t key_len = strlen(key);
+    for (size_t i = 0; i + key_len + 2 <= line.size(); ++i)
+    {
+        if ((i == 0 || line[i - 1] == ' ' || line[i - 1] == ';' || line[i - 1] == '\t') &&
+            strncasecmp(line.data() + i, key, key_len) == 0 && line[i + key_len] == '=' && line[i + key_len + 1] == '"')
+        {
+            size_t start = i + key_len + 2;
+            size_t end = line.find('"', start);
+            if (end == std::string_view::npos)
+                return std::string_view();
+            return line.substr(start, end - start);
+        }
+    }
+    return std::string_view();
+}
+
+//--boundary\r\n 头部 \r\n\r\n 值 \r\n--boundary ... --boundary--
+//值保持原样(multipart不做百分号编码)，只取每个分段的name/filename
+FORM_STATUS form_decoder::parse_multipart(char *body, size_t len, std::string_view boundary)
+{
+    m_count = 0;
+    if (boundary.empty() || boundary.size() > 70)
+        return FORM_BAD;
+    std::string_view data(body, len);
+    char delim[76] = "\r\n--";
+    memcpy(delim + 4, boundary.data(), boundary.size());
+    std::string_view delimiter(delim, boundary.size() + 4);
+
+    //第一个分隔符前可以有前言
+    size_t pos;
+    if (data.substr(0, delimiter.size() - 2) == delimiter.substr(2))
+        pos = delimiter.size() - 2;
+    else
+    {
+        size_t at = data.find(delimiter);
+        if (at == std::string_view::npos)
+            return FORM_BAD;
+        pos = at + delimiter.size();
+    }
+
+    while (1)
+    {
+        //分隔符之后是"--"(结束)或"\r\n"(下一个分段)
+        if (data.compare(pos, 2, "--") == 0)
+            return FORM_OK;
+        if (data.compare(pos, 2, "\r\n") != 0)
+            return FORM_BAD;
+        pos += 2;
+
+        std::string_view name, filename;
+        while (1)
+        {
+            size_t eol = data.find("\r\n", pos);
+            if (eol == std::string_view::npos)
+                return FORM_BAD;
+            std::string_view line = data.substr(pos, eol - pos);
+            pos = eol + 2;
+            if (line.empty())
+                break;
+            if (line.size() >= 20 && strncasecmp(line.data(), "Content-Disposition:", 20) == 0)
+            {
+                name = disposition_param(line, "name");
+                filename = disposition_param(line, "filename");
+            }
+        }
+        if (!name.data())
+            return FORM_BAD;
+
+        size_t end = data.find(delimiter, pos);
+        if (end == std::string_view::npos)
+            return FORM_BAD;
+        FORM_STATUS ret = add(name, data.substr(pos, end - pos), filename);
+        if (ret != FORM_OK)
+            return ret;
+        pos = end + delimiter.size();
+    }
+}
+
+std::string_view form_decoder::get(std::string_view name) const
+{
+    for (int i = 0; i < m_count; ++i)
+    {
+        if (m_fields[i].name == name)
+            return m_fields[i].value;
+    }
+    return std::string_view();
+}
@@ -0,0 +1,52 @@
+//表单解码：application/x-www-form-urlencoded 和 multipart/form-data(只适合小字段)
+//字段名和值都是指向消息体的string_view，不拷贝；urlencoded的%XX和'+'在消息体中就地解码
+//字段数和单个字段长度都有上限，超出时整体失败，不会越界写
+#ifndef FORM_DECODER_H
+#define FORM_DECODER_H
+
+#include <stddef.h>
+#include <string_view>
+
+struct form_field
+{
+    std::string_view name;
+    std::string_view value;
+    std::string_view filename;  //multipart文件字段的文件名，其他情况为空
+};
+
+enum FORM_STATUS
+{
+    FORM_OK = 0,
+    FORM_BAD,        //格式错误或不支持的Content-Type
+    FORM_TOO_LARGE   //字段过多或某个字段超过长度上限
+};
+
+class form_decoder
+{
+public:
+    static const int MAX_FIELDS = 16;
+
+    //max_value：单个字段名/值解码后允许的最大字节数
+    explicit form_decoder(size_t max_value = 1024) : m_max_value(max_value), m_count(0) {}
+
+    //按content_type选择解码方式；body会被就地改写，解码结果在body有效期内可用
+    FORM_STATUS parse(char *body, size_t len, std::string_view content_type);
+    FORM_STATUS parse_urlencoded(char *body, size_t len);
+    FORM_STATUS parse_multipart(char *body, size_t len, std::string_view boundary);
+
+    //取第一个同名字段的值，不存在时data()为NULL
+    std::string_view get(std::string_view name) const;
+    bool has(std::string_view name) const { return get(name).data() != NULL; }
+
+    int size() const { return m_count; }
+    const form_field &at(int i) const { return m_fields[i]; }
+
+private:
+    FORM_STATUS add(std::string_view name, std::string_view value, std::string_view filename);
+
+    size_t m_max_value;
+    form_field m_fields[MAX_FIELDS];
+    int m_count;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include <strings.h>
+#include "header_table.h"
+
+/*-----------------------------已知头部的完美哈希-----------------------------*/
+
+//下标即HEADER_ID，名字统一用小写
+static constexpr std::string_view known_headers[HDR_NUM] = {
+    "connection",
+    "content-length",
+    "content-type",
+    "transfer-encoding",
+    "expect",
+    "host",
+    "range",
+    "if-range",
+    "if-none-match",
+    "if-modified-since",
+    "accept-encoding",
+    "cookie",
+};
+
+//FNV-1a，每个字节先|0x20折叠大小写(字母以外的字符可能误折叠，最终还有一次比较)；
+//新增头部后若下面的static_assert失败，换一个种子即可
+static constexpr uint32_t HEADER_HASH_SEED = 12;
+static constexpr int HEADER_SLOTS = 32;
+
+static constexpr uint32_t header_hash(std::string_view s)
+{
+    uint32_t h = 2166136261u ^ HEADER_HASH_SEED;
+    for (char c : s)
+    {
+        h ^= (unsigned char)c | 0x20;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+struct header_slots
+{
+    int8_t id[HEADER_SLOTS];  //槽位 -> HEADER_ID，-1为空
+    bool perfect;
+};
+
+static constexpr header_slots build_slots()
+{
+    header_slots t = {};
+    t.perfect = true;
+    for (int i = 0; i < HEADER_SLOTS; ++i)
+        t.id[i] = -1;
+    for (int i = 0; i < HDR_NUM; ++i)
+    {
+        int slot = header_hash(known_headers[i]) % HEADER_SLOTS;
+        if (t.id[slot] != -1)
+            t.perfect = false;
+        t.id[slot] = i;
+    }
+    return t;
+}
+
+static constexpr header_slots known_slots = build_slots();
+static_assert(known_slots.perfect, "known headers collide, change HEADER_HASH_SEED");
+
+int header_id(std::string_view name)
+{
+    int id = known_slots.id[header_hash(name) % HEADER_SLOTS];
+    if (id < 0 || known_headers[id].size() != name.size() ||
+        strncasecmp(known_headers[id].data(), name.data(), name.size()) != 0)
+        return HDR_UNKNOWN;
+    return id;
+}
+
+/*-------------------------------header_table--------------------------------*/
+
+void header_table::clear()
+{
+    m_count = 0;
+    for (int i = 0; i < HDR_NUM; ++i)
+        m_values[i].len = 0xffff;
+}
+
+int header_table::add(const char *base, std::string_view name, std::string_view value)
+{
+    m_base = base;
+    span n = {(uint16_t)(name.data() - base), (uint16_t)name.size()};
+    span v = {(uint16_t)(value.data() - base), (uint16_t)value.size()};
+    if (m_count < MAX_HEADERS)
+    {
+        m_headers[m_count].name = n;
+        m_headers[m_count].value = v;
+        ++m_count;
+    }
+    int id = header_id(name);
+    if (id != HDR_UNKNOWN && m_values[id].len == 0xffff)
+        m_values[id] = v;
+    return id;
+}
+
+std::string_view header_table::find(std::string_view name) const
+{
+    for (int i = 0; i < m_count; ++i)
+    {
+        std::string_view n = view(m_headers[i].name);
+        if (n.size() == name.size() && strncasecmp(n.data(), name.data(), name.size()) == 0)
+            return view(m_headers[i].value);
+    }
+    return std::string_view();
+}
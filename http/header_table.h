@@ -0,0 +1,87 @@
+//请求头表：每个头部以(name, value)记录，直接引用读缓冲区中的内容，不拷贝
+//内部只存相对缓冲区起点的16位偏移和长度(请求不超过64KB)，表很小，缓冲区搬家时只需更新起点
+//已知头部按名字的大小写无关完美哈希得到编号，编号到表项的映射可以O(1)取值
+#ifndef HEADER_TABLE_H
+#define HEADER_TABLE_H
+
+#include <stdint.h>
+#include <string_view>
+
+//已知头部，新增时在header_table.cpp的表中加上名字
+enum HEADER_ID
+{
+    HDR_CONNECTION = 0,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE,
+    HDR_TRANSFER_ENCODING,
+    HDR_EXPECT,
+    HDR_HOST,
+    HDR_RANGE,
+    HDR_IF_RANGE,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_ACCEPT_ENCODING,
+    HDR_COOKIE,
+    HDR_NUM,
+    HDR_UNKNOWN = -1
+};
+
+struct http_header
+{
+    std::string_view name;
+    std::string_view value;
+};
+
+//名字到编号，不认识的返回HDR_UNKNOWN
+int header_id(std::string_view name);
+
+class header_table
+{
+public:
+    static const int MAX_HEADERS = 32;  //超出后不再记入列表，已知头部的值仍然生效
+
+    header_table() : m_base(NULL) { clear(); }
+
+    void clear();
+
+    //记录一个头部并返回其编号；name和value必须位于以base开头的读缓冲区中；同名已知头部以第一个为准
+    int add(const char *base, std::string_view name, std::string_view value);
+
+    //已知头部的值，不存在时为空
+    std::string_view get(int id) const { return view(m_values[id]); }
+    //任意头部按名字(大小写无关)查找，线性扫描，用于不常用的头部
+    std::string_view find(std::string_view name) const;
+
+    int size() const { return m_count; }
+    http_header at(int i) const
+    {
+        http_header h = {view(m_headers[i].name), view(m_headers[i].value)};
+        return h;
+    }
+
+    //读缓冲区升级后，改为相对新缓冲区取值
+    void rebase(const char *new_base) { m_base = new_base; }
+
+private:
+    struct span
+    {
+        uint16_t off;  //相对m_base的偏移
+        uint16_t len;  //0xffff表示不存在
+    };
+    struct slot
+    {
+        span name;
+        span value;
+    };
+    std::string_view view(span s) const
+    {
+        return s.len == 0xffff ? std::string_view() : std::string_view(m_base + s.off, s.len);
+    }
+
+    const char *m_base;               //读缓冲区起点
+    slot m_headers[MAX_HEADERS];      //按到达顺序的全部头部
+    int m_count;
+    span m_values[HDR_NUM];           //已知头部按编号存放的值
+};
+
+#endif
@@ -2,20 +2,35 @@
 
 #include <mysql/mysql.h>
 #include <fstream>
+#include <ctype.h>
+#include <limits.h>
+#include <dirent.h>
 
-//定义http响应的一些状态信息
-const char *ok_200_title = "OK";
-const char *error_400_title = "Bad Request";
+//定义http响应的一些状态信息，状态行见response_builder
 const char *error_400_form = "Your request has bad syntax or is inherently impossible to staisfy.\n";
-const char *error_403_title = "Forbidden";
 const char *error_403_form = "You do not have permission to get file form this server.\n";
-const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
-const char *error_500_title = "Internal Error";
+const char *error_411_form = "Uploads must carry a Content-Length.\n";
+const char *error_413_form = "The request body exceeds the size limit of this server.\n";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
 
-locker m_lock;
-map<string, string> users;
+//错误响应状态行之后的部分："Content-Length + Connection + 空行 + 消息体"，下标为keep-alive
+static std::string error_response_rest(const char *form, bool keep_alive)
+{
+    std::string rest = "Content-Length:" + std::to_string(strlen(form)) + "\r\n";
+    rest += keep_alive ? "Connection:keep-alive\r\n\r\n" : "Connection:close\r\n\r\n";
+    return rest + form;
+}
+static const std::string error_400_response[2] = {error_response_rest(error_400_form, false), error_response_rest(error_400_form, true)};
+static const std::string error_403_response[2] = {error_response_rest(error_403_form, false), error_response_rest(error_403_form, true)};
+static const std::string error_404_response[2] = {error_response_rest(error_404_form, false), error_response_rest(error_404_form, true)};
+static const std::string error_411_response[2] = {error_response_rest(error_411_form, false), error_response_rest(error_411_form, true)};
+static const std::string error_413_response[2] = {error_response_rest(error_413_form, false), error_response_rest(error_413_form, true)};
+static const std::string error_500_response[2] = {error_response_rest(error_500_form, false), error_response_rest(error_500_form, true)};
+
+
+//multipart/byteranges响应的分隔符
+static const char *range_boundary = "3d6b6a416f9b5dd3";
 
 /*-------------------------------epoll相关------------------------------*/
 
@@ -71,43 +86,31 @@ void modfd(int epollfd,int fd,int ev,int TRIGMode){
 
 void http_conn::initmysql_result(connection_pool *connPool)
 {
-    //先从连接池中取一个连接
-    MYSQL *mysql = NULL;
-    connectionRAII mysqlcon(&mysql, connPool);
-
-    //在user表中检索username，passwd数据，浏览器端输入
-    if (mysql_query(mysql, "SELECT username,passwd FROM user"))
-    {
-        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
-    }
-
-    //从表中检索完整的结果集
-    MYSQL_RES *result = mysql_store_result(mysql);
-
-    //返回结果集中的列数
-    int num_fields = mysql_num_fields(result);
-
-    //返回所有字段结构的数组
-    MYSQL_FIELD *fields = mysql_fetch_fields(result);
-
-    //从结果集中获取下一行，将对应的用户名和密码，存入map中
-    while (MYSQL_ROW row = mysql_fetch_row(result))
-    {
-        string temp1(row[0]);
-        string temp2(row[1]);
-        users[temp1] = temp2;
-    }
+    //不再在启动时读取整张user表：用户按需查库并缓存，缓存有上限；
+    //这里只启动后台线程加载用户名的布隆过滤器
+    user_cache::get_instance()->init(connPool, connPool->m_close_log);
 }
 
 
 /*-------------------------http初始化和关闭------------------------------*/
 int http_conn::m_user_count = 0;
 int http_conn::m_epollfd = -1;
+int http_conn::m_transmit_mode = http_conn::TRANSMIT_SENDFILE;
+long http_conn::m_sendfile_min_size = 16 * 1024;
+long http_conn::m_prebuilt_max_size = 8 * 1024;
+std::string http_conn::m_spool_dir;
+std::atomic<long> http_conn::m_db_requests(0);
+long http_conn::m_upload_max_size = 0;
+std::string http_conn::m_sql_user;
+std::string http_conn::m_sql_passwd;
+std::string http_conn::m_sql_name;
 
 //关闭连接，关闭一个连接，客户总量减一
 void http_conn::close_conn(bool real_close){
     if(real_close &&  (m_sockfd != -1)){
         printf("close %d\n",m_sockfd);
+        unmap();
+        end_upload();
         removefd(m_epollfd,m_sockfd);
 
         m_sockfd = -1;
@@ -121,6 +124,8 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 {
     m_sockfd = sockfd;
     m_address = addr;
+    m_upload_fd = -1;
+    m_upload_pipe[0] = m_upload_pipe[1] = -1;
 
     addfd(m_epollfd, sockfd, true, m_TRIGMode);
     m_user_count++;
@@ -130,9 +135,13 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
     m_TRIGMode = TRIGMode;
     m_close_log = close_log;
 
-    strcpy(sql_user, user.c_str());
-    strcpy(sql_passwd, passwd.c_str());
-    strcpy(sql_name, sqlname.c_str());
+    //数据库配置所有连接相同，只保存一份
+    if (m_sql_user.empty())
+    {
+        m_sql_user = user;
+        m_sql_passwd = passwd;
+        m_sql_name = sqlname;
+    }
 
     init();
 }
@@ -141,7 +150,36 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 //check_state默认为分析请求行状态
 void http_conn::init()
 {
-    mysql = NULL;
+    end_upload();
+    m_read_idx = 0;
+    m_read_buf.release();
+    reset_request();
+}
+
+//keep-alive响应发送完毕后调用：读缓冲区中已经收到的下一个(流水线)请求不能丢，
+//把它搬到缓冲区开头，只重置解析状态
+void http_conn::init_pipelined()
+{
+    long left = m_read_idx - m_checked_idx;
+    if (left <= 0)
+    {
+        init();
+        return;
+    }
+
+    char *buf = m_read_buf.data();
+    //parse_content为消息体补'\0'时覆盖了下一个请求的首字节，这里还原
+    if (m_string)
+        buf[m_checked_idx] = m_content_tail;
+    memmove(buf, buf + m_checked_idx, left);
+    buf[left] = '\0';
+    m_read_idx = left;
+    reset_request();
+}
+
+//重置单个请求的解析与响应状态，读缓冲区中的数据由调用者处理
+void http_conn::reset_request()
+{
     bytes_to_send = 0;
     bytes_have_send = 0;
     m_check_state = CHECK_STATE_REQUESTLINE;
@@ -150,19 +188,72 @@ void http_conn::init()
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
+    m_content_tail = '\0';
+    m_file = NULL;
+    m_prebuilt = NULL;
+    m_range = 0;
+    m_if_range = 0;
+    m_if_none_match = 0;
+    m_if_modified_since = 0;
+    m_accept_encoding = 0;
+    m_headers.clear();
+    m_chunked = false;
+    m_chunk_state = CHUNK_SIZE;
+    m_chunk_left = 0;
+    m_body_start = 0;
+    m_body_len = 0;
+    m_stream = NULL;
+    m_stream_state = 0;
+    m_upload_left = 0;
+    m_content_encoding = NULL;
+    m_vary = false;
+    m_etag = NULL;
+    m_compressed = NULL;
+    m_range_count = 0;
+    m_file_address = 0;
+    m_file_fd = -1;
+    m_file_offset = 0;
     m_host = 0;
+    m_string = 0;
     m_start_line = 0;
     m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
     cgi = 0;
     m_state = 0;
     timer_flag = 0;
     improv = 0;
 
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);
+    m_write_buf.clear();
+    m_arena.reset();
+}
+
+
+
+size_t http_conn::resident_bytes() const
+{
+    return sizeof(http_conn) + m_read_buf.capacity() + m_write_buf.capacity() + m_arena.capacity();
+}
+
+void http_conn::report_memory(const http_conn *conns, int n)
+{
+    if (n <= 0)
+        return;
+    //LOG_INFO宏使用名为m_close_log的变量，静态函数里取第一个连接的配置
+    int m_close_log = conns[0].m_close_log;
+    int open = 0, active = 0;
+    size_t total = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        //没有init过或已关闭的槽位不读它的缓冲区状态
+        if (conns[i].m_sockfd < 0)
+            continue;
+        size_t bytes = conns[i].resident_bytes();
+        total += bytes;
+        ++open;
+        if (bytes > sizeof(http_conn))
+            ++active;
+    }
+    LOG_INFO("connections open:%d active:%d resident:%zu bytes, idle connection:%zu bytes",
+             open, active, total, sizeof(http_conn));
 }
 
 
@@ -173,23 +264,28 @@ void http_conn::init()
 //非阻塞ET工作模式下，需要一次性将数据读完
 bool http_conn::read_once()
 {
-    if (m_read_idx >= READ_BUFFER_SIZE)
+    //上传中的消息体不进读缓冲区
+    if (m_upload_fd >= 0)
+        return read_upload();
+    if (m_read_idx >= read_buffer::MAX_SIZE - 1)
     {
         return false;
     }
     int bytes_read = 0;
+    char *old_base = m_read_buf.data();
 
-    //LT读取数据：只进行一次 recv 调用。
+    //LT读取数据：只进行一次 readv 调用。
     if (0 == m_TRIGMode)
     {
-        // 从套接字读取数据到缓冲区
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
-        m_read_idx += bytes_read;//更新已读取的数据量
+        // 从套接字读取数据到缓冲区，放不下的部分由溢出区接住
+        bytes_read = m_read_buf.read_fd(m_sockfd, m_read_idx);
 
         if (bytes_read <= 0)//如果读取失败或连接关闭（bytes_read <= 0），返回 false。
         {
             return false;
         }
+        m_read_idx += bytes_read;//更新已读取的数据量
+        rebase(old_base);
 
         return true;
     }
@@ -198,7 +294,11 @@ bool http_conn::read_once()
     {
         while (true)
         {
-            bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+            //缓冲区已满时先交给process_read：上传会把已读到的消息体写走；
+            //不是上传时请求仍不完整，重新注册事件后立即再次可读，由函数开头的检查关闭连接
+            if (m_read_idx >= read_buffer::MAX_SIZE - 1)
+                break;
+            bytes_read = m_read_buf.read_fd(m_sockfd, m_read_idx);
 
 
             //a. 读取出错（EAGAIN 或 EWOULDBLOCK 除外） 
@@ -216,10 +316,39 @@ bool http_conn::read_once()
             }
             m_read_idx += bytes_read;
         }
+        rebase(old_base);
         return true;
     }
 }
 
+//缓冲区第一次借到池化块或升级为更大的块后，已解析出的指针需要跟着平移
+void http_conn::rebase(char *old_base)
+{
+    char *new_base = m_read_buf.data();
+    if (new_base == old_base)
+        return;
+
+    if (m_url)
+        m_url = new_base + (m_url - old_base);
+    if (m_version)
+        m_version = new_base + (m_version - old_base);
+    if (m_host)
+        m_host = new_base + (m_host - old_base);
+    if (m_string)
+        m_string = new_base + (m_string - old_base);
+    if (m_range)
+        m_range = new_base + (m_range - old_base);
+    if (m_if_range)
+        m_if_range = new_base + (m_if_range - old_base);
+    if (m_if_none_match)
+        m_if_none_match = new_base + (m_if_none_match - old_base);
+    if (m_if_modified_since)
+        m_if_modified_since = new_base + (m_if_modified_since - old_base);
+    if (m_accept_encoding)
+        m_accept_encoding = new_base + (m_accept_encoding - old_base);
+    m_headers.rebase(new_base);
+}
+
 
 
 /*----------------------解析报文(主从状态机)----------------------*/
@@ -238,8 +367,6 @@ http_conn::HTTP_CODE http_conn::process_read(){
         text = get_line();
         // 更新下一行的起始位置
         m_start_line = m_checked_idx;
-        // 记录日志
-        LOG_INFO("%s", text);
 
         // 根据当前的检查状态，调用相应的处理函数
         switch(m_check_state){
@@ -254,21 +381,33 @@ http_conn::HTTP_CODE http_conn::process_read(){
             {
                 // 解析请求头
                 ret = parse_headers(text);
-                if(ret == BAD_REQUEST) return BAD_REQUEST;
-                else if(ret == GET_REQUEST) return do_request();
+                if(ret == GET_REQUEST) return do_request();
+                // 头部出错时消息体还没有读，后面的字节不能当作下一个请求解析，响应后关闭连接
+                if(ret == BAD_REQUEST) m_linger = false;
+                // 出错，或者上传在头部阶段就已经有了结果
+                if(ret != NO_REQUEST) return ret;
                 break;
             }
             case CHECK_STATE_CONTENT:
             {
+                // 上传的消息体由read_once()直接搬到文件，这里只检查是否收完
+                if (m_upload_fd >= 0)
+                    return m_upload_left > 0 ? NO_REQUEST : finish_upload();
                 // 解析请求体
-                ret = parse_content(text);
+                ret = m_chunked ? parse_chunked() : parse_content(text);
                 if(ret == GET_REQUEST) return do_request();
+                // chunked编码出错后找不到消息体的结尾，剩下的字节不能当作下一个请求解析，响应后关闭连接
+                if(ret == BAD_REQUEST){
+                    m_linger = false;
+                    return BAD_REQUEST;
+                }
                 // 请求体可能不是一行就结束，需要继续读取
-                line_status = LINE_OPEN;
-                break;
+                // 直接返回，否则循环条件会调用parse_line()把消息体当成行扫描，推进m_checked_idx
+                return NO_REQUEST;
             }
             default:
-                // 未知状态，返回内部错误
+                // 未知状态，返回内部错误，连接上剩下的数据无法再解析
+                m_linger = false;
                 return INTERNAL_ERROR;
         }
     }
@@ -282,10 +421,14 @@ http_conn::HTTP_CODE http_conn::process_read(){
 http_conn::LINE_STATUS http_conn::parse_line()
 {
     char temp;
-    // 遍历缓冲区中的每个字符
+    char *buf = m_read_buf.data();
+    // 遍历缓冲区中的每个字符，用向量化扫描直接跳到下一个'\r'或'\n'
     for (; m_checked_idx < m_read_idx; ++m_checked_idx)
     {
-        temp = m_read_buf[m_checked_idx];
+        m_checked_idx += find_crlf(buf + m_checked_idx, m_read_idx - m_checked_idx);
+        if (m_checked_idx >= m_read_idx)
+            break;
+        temp = buf[m_checked_idx];
         // 检查是否遇到回车符 '\r'
         if (temp == '\r')
         {
@@ -293,11 +436,11 @@ http_conn::LINE_STATUS http_conn::parse_line()
             if ((m_checked_idx + 1) == m_read_idx)
                 return LINE_OPEN;
             // 如果回车符后面紧跟换行符 '\n'，说明找到了完整的行
-            else if (m_read_buf[m_checked_idx + 1] == '\n')
+            else if (buf[m_checked_idx + 1] == '\n')
             {
                 // 将 '\r\n' 替换为字符串结束符 '\0'
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
+                buf[m_checked_idx++] = '\0';
+                buf[m_checked_idx++] = '\0';
                 return LINE_OK;
             }
             // 如果回车符后面不是换行符，说明行格式错误
@@ -307,11 +450,11 @@ http_conn::LINE_STATUS http_conn::parse_line()
         else if (temp == '\n')
         {
             // 检查换行符前面是否是回车符
-            if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r')
+            if (m_checked_idx > 1 && buf[m_checked_idx - 1] == '\r')
             {
                 // 将 '\r\n' 替换为字符串结束符 '\0'
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
+                buf[m_checked_idx - 1] = '\0';
+                buf[m_checked_idx++] = '\0';
                 return LINE_OK;
             }
             // 如果换行符前面不是回车符，说明行格式错误
@@ -345,6 +488,8 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
         m_method = POST;
         cgi = 1;  // 标记为CGI请求
     }
+    else if (strcasecmp(method, "PUT") == 0)
+        m_method = PUT;  // 只用于上传
     else
         return BAD_REQUEST;
 
@@ -382,22 +527,63 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     if (!m_url || m_url[0] != '/')
         return BAD_REQUEST;
     
-    // 如果URL只有"/"，显示默认的判断界面
-    if (strlen(m_url) == 1)
-        strcat(m_url, "judge.html");
-    
+    // URL只有"/"时显示默认的判断界面，由路由表处理
     // 更新解析状态为检查请求头
     m_check_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
 }
 
+//Content-Length只能是十进制数字(后面可以有空白)，溢出long也算非法
+static bool parse_content_length(const char *value, long *len)
+{
+    long n = 0;
+    const char *p = value;
+    for (; *p >= '0' && *p <= '9'; ++p)
+    {
+        if (n > (LONG_MAX - (*p - '0')) / 10)
+            return false;
+        n = n * 10 + (*p - '0');
+    }
+    if (p == value || p[strspn(p, " \t")] != '\0')
+        return false;
+    *len = n;
+    return true;
+}
+
 // 解析HTTP请求头
 http_conn::HTTP_CODE http_conn::parse_headers(char *text)
 {
     // 如果遇到空行，说明头部解析完毕
     if (text[0] == '\0')
     {
+        // 上传的消息体不进读缓冲区，直接写入暂存文件
+        if ((m_method == PUT || m_method == POST) && !m_spool_dir.empty())
+        {
+            const route *r = router::get_instance()->match(m_url);
+            if (r && r->action == ROUTE_UPLOAD)
+            {
+                HTTP_CODE ret = begin_upload();
+                //411、413、400或打开暂存文件失败时消息体还没有读，后面的字节不能当作下一个请求解析，响应后关闭连接
+                if (ret != NO_REQUEST && ret != UPLOAD_CREATED)
+                    m_linger = false;
+                return ret;
+            }
+        }
+        if (m_method == PUT)
+            return BAD_REQUEST;
         // 如果有消息体，则转到消息体处理状态
+        if (m_chunked)
+        {
+            m_body_start = m_checked_idx;
+            m_check_state = CHECK_STATE_CONTENT;
+            return NO_REQUEST;
+        }
+        // 不是上传时消息体要整个放进读缓冲区，超过上限的直接拒绝，消息体没有读，响应后关闭连接
+        if (m_content_length > read_buffer::MAX_SIZE)
+        {
+            m_linger = false;
+            return PAYLOAD_TOO_LARGE;
+        }
         if (m_content_length != 0)
         {
             m_check_state = CHECK_STATE_CONTENT;
@@ -406,35 +592,67 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         // 如果没有消息体，则解析完成
         return GET_REQUEST;
     }
-    // 处理Connection头部
-    else if (strncasecmp(text, "Connection:", 11) == 0)
+
+    // 拆成名字和值记入头部表，值去掉前导空白；没有冒号的行忽略
+    char *colon = strchr(text, ':');
+    if (!colon)
+        return NO_REQUEST;
+    char *value = colon + 1;
+    value += strspn(value, " \t");
+    int id = m_headers.add(m_read_buf.data(), std::string_view(text, colon - text), std::string_view(value, strlen(value)));
+
+    // 已知头部按编号分派到对应字段，未知头部只留在表中
+    switch (id)
     {
-        text += 11;
-        text += strspn(text, " \t");
+    case HDR_CONNECTION:
         // 如果是keep-alive，则保持连接
-        if (strcasecmp(text, "keep-alive") == 0)
-        {
+        if (strcasecmp(value, "keep-alive") == 0)
             m_linger = true;
-        }
-    }
-    // 处理Content-length头部
-    else if (strncasecmp(text, "Content-length:", 15) == 0)
+        break;
+    case HDR_CONTENT_LENGTH:
     {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
+        // 负数或非数字的长度会让消息体的边界落到缓冲区之外或已解析的头部里
+        long len;
+        if (!parse_content_length(value, &len))
+            return BAD_REQUEST;
+        // 头部表以第一个为准，重复出现且值不同时前后对消息体长度的理解不一致，按请求走私拒绝
+        if (m_headers.get(HDR_CONTENT_LENGTH).data() != value && len != m_content_length)
+            return BAD_REQUEST;
+        m_content_length = len;
+        break;
     }
-    // 处理Host头部
-    else if (strncasecmp(text, "Host:", 5) == 0)
+    case HDR_TRANSFER_ENCODING:
     {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
+        // 只支持最后一个编码为chunked；同时带Content-Length时以chunked为准，响应后关闭连接
+        const char *last = strrchr(value, ',');
+        last = last ? last + 1 : value;
+        last += strspn(last, " \t");
+        if (strncasecmp(last, "chunked", 7) != 0 || last[7 + strspn(last + 7, " \t")] != '\0')
+            return BAD_REQUEST;
+        m_chunked = true;
+        break;
     }
-    // 其他未知头部
-    else
-    {
-        LOG_INFO("oop!unknow header: %s", text);
+    case HDR_HOST:
+        m_host = value;
+        break;
+    case HDR_RANGE:
+        // 范围在do_request中结合文件大小解析
+        m_range = value;
+        break;
+    case HDR_IF_RANGE:
+        m_if_range = value;
+        break;
+    case HDR_IF_NONE_MATCH:
+        m_if_none_match = value;
+        break;
+    case HDR_IF_MODIFIED_SINCE:
+        m_if_modified_since = value;
+        break;
+    case HDR_ACCEPT_ENCODING:
+        m_accept_encoding = value;
+        break;
+    default:
+        break;
     }
     // 继续解析下一个头部
     return NO_REQUEST;
@@ -443,137 +661,397 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
 //判断http请求是否被完整读入
 http_conn::HTTP_CODE http_conn::parse_content(char *text)
 {
-    if (m_read_idx >= (m_content_length + m_checked_idx))
+    //写成减法，长度很大时也不会溢出
+    if (m_content_length <= m_read_idx - m_checked_idx)
     {
+        //记下被'\0'覆盖的字节，它可能是流水线中下一个请求的开头
+        m_content_tail = text[m_content_length];
         text[m_content_length] = '\0';
         //POST请求中最后为输入的用户名和密码
         m_string = text;
+        //消息体消费完毕，m_checked_idx指向下一个请求
+        m_checked_idx += m_content_length;
         return GET_REQUEST;
     }
     return NO_REQUEST;
 }
 
+//chunked请求体：按"大小行 数据 \r\n"逐块解码，数据向前搬到m_body_start之后连续存放，
+//解码位置总在读取位置之前，可以原地进行；数据不完整时记下状态，下次读到数据后继续
+http_conn::HTTP_CODE http_conn::parse_chunked()
+{
+    char *buf = m_read_buf.data();
+    while (1)
+    {
+        switch (m_chunk_state)
+        {
+        case CHUNK_SIZE:
+        case CHUNK_TRAILER:
+        {
+            long avail = m_read_idx - m_checked_idx;
+            long len = find_crlf(buf + m_checked_idx, avail);
+            if (len >= avail - 1)
+                return len > 1024 ? BAD_REQUEST : NO_REQUEST;
+            if (buf[m_checked_idx + len] != '\r' || buf[m_checked_idx + len + 1] != '\n')
+                return BAD_REQUEST;
+            char *line = buf + m_checked_idx;
+            m_checked_idx += len + 2;
+            if (m_chunk_state == CHUNK_TRAILER)
+            {
+                //trailer字段忽略，空行表示消息体结束
+                if (len != 0)
+                    break;
+                //解码后的消息体比编码前至少短5字节("0\r\n\r\n")，补'\0'不会碰到下一个请求
+                buf[m_body_start + m_body_len] = '\0';
+                m_content_tail = buf[m_checked_idx];
+                m_string = buf + m_body_start;
+                m_content_length = m_body_len;
+                //请求同时带了Content-Length，可能是请求走私，不复用连接
+                if (!m_headers.get(HDR_CONTENT_LENGTH).empty())
+                    m_linger = false;
+                return GET_REQUEST;
+            }
+            //大小为十六进制，后面可以跟";扩展"
+            long size = 0;
+            int digits = 0;
+            for (; digits < len && isxdigit((unsigned char)line[digits]); ++digits)
+            {
+                size = size * 16 + (isdigit((unsigned char)line[digits]) ? line[digits] - '0' : (line[digits] | 0x20) - 'a' + 10);
+                if (size >= read_buffer::MAX_SIZE)
+                    return BAD_REQUEST;
+            }
+            if (digits == 0 || (digits < len && line[digits] != ';' && line[digits] != ' ' && line[digits] != '\t'))
+                return BAD_REQUEST;
+            m_chunk_left = size;
+            m_chunk_state = size ? CHUNK_DATA : CHUNK_TRAILER;
+            break;
+        }
+        case CHUNK_DATA:
+        {
+            long n = m_read_idx - m_checked_idx;
+            if (n > m_chunk_left)
+                n = m_chunk_left;
+            if (n == 0)
+                return NO_REQUEST;
+            memmove(buf + m_body_start + m_body_len, buf + m_checked_idx, n);
+            m_body_len += n;
+            m_checked_idx += n;
+            m_chunk_left -= n;
+            if (m_chunk_left == 0)
+                m_chunk_state = CHUNK_DATA_END;
+            break;
+        }
+        case CHUNK_DATA_END:
+            if (m_read_idx - m_checked_idx < 2)
+                return NO_REQUEST;
+            if (buf[m_checked_idx] != '\r' || buf[m_checked_idx + 1] != '\n')
+                return BAD_REQUEST;
+            m_checked_idx += 2;
+            m_chunk_state = CHUNK_SIZE;
+            break;
+        }
+    }
+}
+
 
+/*---------------------------------上传------------------------------------*/
 
-/*------------------------响应报文------------------------*/
+//GET /uploads：列出上传目录中已完成的文件，目录可能很大，以chunked编码边读边发；
+//每次调用读出至多UPLOAD_LIST_BATCH项，state记录下一项在目录中的位置(telldir)，0表示还没有输出表头
+static const int UPLOAD_LIST_BATCH = 64;
+static const long UPLOAD_LIST_START = -1;
 
-//处理HTTP请求并生成适当的响应,将请求的文件进行内存映射
-http_conn::HTTP_CODE http_conn::do_request()
+static bool list_uploads(const char *url, long *state, response_builder &out)
 {
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    //printf("m_url:%s\n", m_url);
-    const char *p = strrchr(m_url, '/');
+    (void)url;
+    if (*state == 0)
+    {
+        out.append_literal("<html><body><table>\n<tr><th>name</th><th>bytes</th></tr>\n");
+        *state = UPLOAD_LIST_START;
+        return true;
+    }
+
+    DIR *dir = opendir(http_conn::m_spool_dir.c_str());
+    if (!dir)
+    {
+        out.append_literal("</table></body></html>\n");
+        return false;
+    }
+    if (*state != UPLOAD_LIST_START)
+        seekdir(dir, *state);
 
-    //处理cgi
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
+    bool more = true;
+    for (int n = 0; n < UPLOAD_LIST_BATCH;)
     {
+        struct dirent *de = readdir(dir);
+        if (!de)
+        {
+            more = false;
+            break;
+        }
+        //只列出上传接口能产生的名字，跳过隐藏文件和未完成上传的暂存文件
+        const char *name = de->d_name;
+        if (name[0] == '.' || strstr(name, ".part.") ||
+            name[strspn(name, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._-")] != '\0')
+            continue;
+        struct stat st;
+        if (fstatat(dirfd(dir), name, &st, 0) < 0 || !S_ISREG(st.st_mode))
+            continue;
+        out.append_literal("<tr><td>");
+        out.append(name);
+        out.append_literal("</td><td>");
+        out.append_num(st.st_size);
+        out.append_literal("</td></tr>\n");
+        ++n;
+    }
+    if (more)
+        *state = telldir(dir);
+    else
+        out.append_literal("</table></body></html>\n");
+    closedir(dir);
+    return more;
+}
 
-        //根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
+void http_conn::init_upload(const char *spool_dir, long max_size)
+{
+    m_spool_dir = spool_dir;
+    m_upload_max_size = max_size;
+    router::get_instance()->add("/upload", false, ROUTE_UPLOAD, NULL);
+    router::get_instance()->add("/upload/", true, ROUTE_UPLOAD, NULL);
+    router::get_instance()->add("/uploads", false, ROUTE_STREAM, NULL, list_uploads);
+}
 
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
+//头部收完后开始上传：确定文件名，创建暂存文件和管道，先把已经读进缓冲区的那部分消息体写入文件
+http_conn::HTTP_CODE http_conn::begin_upload()
+{
+    if (m_chunked || m_headers.get(HDR_CONTENT_LENGTH).empty())
+        return LENGTH_REQUIRED;
+    if (m_content_length > m_upload_max_size)
+        return PAYLOAD_TOO_LARGE;
+
+    //文件名取/upload/之后的部分，只允许字母、数字和._-，不能以'.'开头；没有时由服务器生成
+    static unsigned long upload_seq = 0;
+    unsigned long seq = __sync_fetch_and_add(&upload_seq, 1);
+    const char *name = m_url + strlen("/upload");
+    if (*name == '/')
+        ++name;
+    char generated[64];
+    if (*name == '\0')
+    {
+        snprintf(generated, sizeof(generated), "upload-%ld-%lu", (long)time(NULL), seq);
+        name = generated;
+    }
+    else if (name[0] == '.' || strlen(name) > 128 ||
+             name[strspn(name, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._-")] != '\0')
+        return BAD_REQUEST;
 
-        //将用户名和密码提取出来
-        //user=123&passwd=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
+    //两个路径都放在请求的arena中，上传结束(或连接关闭)前一直有效
+    size_t path_max = m_spool_dir.size() + strlen(name) + 32;
+    m_upload_path = (char *)m_arena.alloc(path_max, 1);
+    m_upload_tmp_path = (char *)m_arena.alloc(path_max, 1);
+    if (!m_upload_path || !m_upload_tmp_path)
+        return INTERNAL_ERROR;
+    snprintf(m_upload_path, path_max, "%s/%s", m_spool_dir.c_str(), name);
+    snprintf(m_upload_tmp_path, path_max, "%s.part.%lu", m_upload_path, seq);
+    m_upload_fd = open(m_upload_tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_upload_fd < 0)
+    {
+        LOG_ERROR("upload open %s failed: %s", m_upload_path, strerror(errno));
+        return INTERNAL_ERROR;
+    }
+    if (pipe2(m_upload_pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        end_upload();
+        return INTERNAL_ERROR;
+    }
 
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
+    //与头部一起读到的消息体只能从缓冲区写入；超出消息体的部分属于下一个请求，留在缓冲区
+    long buffered = m_read_idx - m_checked_idx;
+    if (buffered > m_content_length)
+        buffered = m_content_length;
 
-        if (*(p + 1) == '3')
+    //客户端带Expect: 100-continue时先等服务器表态再发消息体，不回应的话curl等会空等约1秒；
+    //上传已经被接受，消息体还一个字节都没收到时才需要回应；此时发送缓冲区是空的，发不完整按出错处理
+    if (buffered == 0 && m_content_length > 0)
+    {
+        std::string_view expect = m_headers.get(HDR_EXPECT);
+        expect = expect.substr(0, expect.find_last_not_of(" \t") + 1);
+        if (expect.size() == 12 && strncasecmp(expect.data(), "100-continue", 12) == 0)
         {
-            //如果是注册，先检测数据库中是否有重名的
-            //没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-            
-            m_lock.lock();
-            if (users.find(name) == users.end())
+            static const char interim[] = "HTTP/1.1 100 Continue\r\n\r\n";
+            if (send(m_sockfd, interim, sizeof(interim) - 1, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)sizeof(interim) - 1)
             {
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
-
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
+                end_upload();
+                return INTERNAL_ERROR;
             }
-            else
-                strcpy(m_url, "/registerError.html");
         }
-        //如果是登录，直接判断
-        //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-        else if (*(p + 1) == '2')
+    }
+    char *buf = m_read_buf.data() + m_checked_idx;
+    for (long done = 0; done < buffered;)
+    {
+        ssize_t n = ::write(m_upload_fd, buf + done, buffered - done);
+        if (n <= 0)
         {
-            if (users.find(name) != users.end() && users[name] == password)
-                strcpy(m_url, "/welcome.html");
-            else
-                strcpy(m_url, "/logError.html");
+            end_upload();
+            return INTERNAL_ERROR;
         }
+        done += n;
     }
+    m_checked_idx += buffered;
+    m_upload_left = m_content_length - buffered;
+    m_check_state = CHECK_STATE_CONTENT;
+    return m_upload_left > 0 ? NO_REQUEST : finish_upload();
+}
 
-    if (*(p + 1) == '0')
+//socket可读时调用：socket -> 管道 -> 文件，数据只在内核中移动；
+//每次最多搬运UPLOAD_BYTES_PER_READ字节就返回，剩下的等下一次可读事件
+bool http_conn::read_upload()
+{
+    long moved = 0;
+    while (m_upload_left > 0 && moved < UPLOAD_BYTES_PER_READ)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        size_t want = m_upload_left < 65536 ? m_upload_left : 65536;
+        ssize_t n = splice(m_sockfd, NULL, m_upload_pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0)
+            return false;
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return false;
+        }
+        m_upload_left -= n;
+        moved += n;
+        //每次都把管道排空，管道容量不会成为瓶颈
+        while (n > 0)
+        {
+            ssize_t m = splice(m_upload_pipe[0], NULL, m_upload_fd, NULL, n, SPLICE_F_MOVE);
+            if (m <= 0)
+            {
+                LOG_ERROR("upload write %s failed: %s", m_upload_path, strerror(errno));
+                return false;
+            }
+            n -= m;
+        }
     }
-    else if (*(p + 1) == '1')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+    return true;
+}
 
-        free(m_url_real);
-    }
-    else if (*(p + 1) == '5')
+//消息体收完：关闭文件并改为正式文件名
+http_conn::HTTP_CODE http_conn::finish_upload()
+{
+    close(m_upload_fd);
+    m_upload_fd = -1;
+    end_upload();
+    if (rename(m_upload_tmp_path, m_upload_path) < 0)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        unlink(m_upload_tmp_path);
+        return INTERNAL_ERROR;
+    }
+    return UPLOAD_CREATED;
+}
 
-        free(m_url_real);
+//释放上传占用的管道；上传没有完成时删除暂存文件
+void http_conn::end_upload()
+{
+    if (m_upload_fd >= 0)
+    {
+        close(m_upload_fd);
+        m_upload_fd = -1;
+        unlink(m_upload_tmp_path);
     }
-    else if (*(p + 1) == '6')
+    if (m_upload_pipe[0] >= 0)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        close(m_upload_pipe[0]);
+        close(m_upload_pipe[1]);
+        m_upload_pipe[0] = m_upload_pipe[1] = -1;
+    }
+}
+
+
+
+/*------------------------响应报文------------------------*/
 
-        free(m_url_real);
+//处理HTTP请求并生成适当的响应,将请求的文件进行内存映射
+//登录/注册表单：校验或写入用户，返回要显示的结果页面
+const char *http_conn::handle_user_form(bool is_register)
+{
+    const char *error_page = is_register ? "/registerError.html" : "/logError.html";
+
+    //将用户名和密码提取出来，字段值直接指向消息体，%XX在原地解码
+    //user=123&passwd=123
+    form_decoder form(MAX_CREDENTIAL_LEN);
+    //消息体必须完整地在读缓冲区里，否则parse会读到缓冲区之外
+    long buffered = m_string ? m_read_buf.data() + m_read_idx - m_string : 0;
+    if (m_content_length < 0 || m_content_length > buffered)
+        return error_page;
+    if (form.parse(m_string, m_content_length, m_headers.get(HDR_CONTENT_TYPE)) != FORM_OK)
+        return error_page;
+    string_view name = form.get("user");
+    string_view password = form.get("passwd");
+    if (name.empty() || !password.data())
+        return error_page;
+
+    //数据库连接不再由线程池预先分配：只有缓存无法确定时，user_cache才临时借一个，查完立即归还
+    bool used_db = false;
+    const char *page;
+    if (is_register)
+    {
+        //如果是注册，重名或写库失败都返回注册失败页面
+        page = user_cache::get_instance()->add_user(name, password, &used_db) ? "/log.html" : error_page;
     }
-    else if (*(p + 1) == '7')
+    else
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        //如果是登录，先查缓存
+        page = user_cache::get_instance()->check(name, password, &used_db) == USER_OK ? "/welcome.html" : error_page;
+    }
+    if (used_db)
+        m_db_requests.fetch_add(1, std::memory_order_relaxed);
+    return page;
+}
 
-        free(m_url_real);
+http_conn::HTTP_CODE http_conn::do_request()
+{
+    //目标文件的完整路径 = doc_root + 页面，只在查找缓存时用到，放在栈上
+    char real_file[FILENAME_LEN];
+    int len = snprintf(real_file, sizeof(real_file), "%s", doc_root);
+    if (len >= FILENAME_LEN)
+        return INTERNAL_ERROR;
+
+    //路由表决定发送哪个文件：固定页面、登录/注册结果页，或者URL本身对应的静态文件
+    const char *page = m_url;
+    const route *r = router::get_instance()->match(m_url);
+    if (r)
+    {
+        switch (r->action)
+        {
+        case ROUTE_PAGE:
+            page = r->page;
+            break;
+        case ROUTE_STREAM:
+            //内容由生成函数边生成边发送，不对应文件
+            m_stream = r->stream;
+            m_stream_state = 0;
+            return STREAM_REQUEST;
+        case ROUTE_LOGIN:
+        case ROUTE_REGISTER:
+            //只处理POST提交的表单，其他方法按静态文件处理
+            if (cgi == 1 && m_string)
+                page = handle_user_form(r->action == ROUTE_REGISTER);
+            break;
+        default:
+            break;
+        }
     }
-    else
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+    if (len + strlen(page) >= (size_t)FILENAME_LEN)
+        return BAD_REQUEST;
+    strcpy(real_file + len, page);
 
-    if (stat(m_real_file, &m_file_stat) < 0)
+    //静态文件走进程级缓存，命中时没有stat/open/mmap
+    m_file = file_cache::get_instance()->acquire(real_file);
+    if (!m_file)
         return NO_RESOURCE;
+    m_file_stat = m_file->st;
 
     if (!(m_file_stat.st_mode & S_IROTH))
         return FORBIDDEN_REQUEST;
@@ -581,77 +1059,378 @@ http_conn::HTTP_CODE http_conn::do_request()
     if (S_ISDIR(m_file_stat.st_mode))
         return BAD_REQUEST;
 
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
+    if (m_file->fd < 0)
+        return NO_RESOURCE;
+
+    //客户端接受压缩且旁边有预压缩文件时改发.br/.gz，之后的304、Range和发送都针对压缩版本
+    if (m_file->sidecars)
+    {
+        m_vary = true;
+        if (m_accept_encoding)
+            select_sidecar();
+    }
+    m_etag = m_file->etag;
+
+    //没有预压缩文件的文本文件在运行时压缩，结果缓存在文件条目中，每个文件只压缩一次
+    if (!m_content_encoding && m_file->compressible)
+    {
+        m_vary = true;
+        if (m_accept_encoding)
+            select_compressed();
+    }
+
+    //条件请求：缓存仍然有效时返回304，不发送也不映射文件
+    if (not_modified())
+        return NOT_MODIFIED;
+
+    //压缩结果直接从内存发送，不支持Range(按RFC 7233可以忽略Range)
+    if (m_compressed)
+        return FILE_REQUEST;
+
+    //Range请求只发送请求的区间；If-Range不匹配时按完整文件响应
+    if (m_range && (!m_if_range || if_range_match()))
+    {
+        m_range_count = parse_range(m_range);
+        if (m_range_count < 0)
+            return RANGE_NOT_SATISFIABLE;
+        if (m_range_count > 0)
+        {
+            //单区间在sendfile模式下从区间起点sendfile；多区间要与分段头交错，用映射+writev
+            if (m_range_count == 1 && m_transmit_mode == TRANSMIT_SENDFILE && m_file_stat.st_size >= m_sendfile_min_size)
+            {
+                m_file_fd = m_file->fd;
+                m_file_offset = m_ranges[0][0];
+                return PARTIAL_REQUEST;
+            }
+            m_file_address = file_cache::get_instance()->mapping(m_file);
+            if (!m_file_address)
+                return INTERNAL_ERROR;
+            return PARTIAL_REQUEST;
+        }
+    }
+
+    //小文件直接使用缓存中预先拼好的完整响应，一次send发完
+    if (m_file_stat.st_size <= m_prebuilt_max_size)
+    {
+        m_prebuilt = file_cache::get_instance()->full_response(m_file, m_linger, m_content_encoding);
+        if (m_prebuilt)
+            return FILE_REQUEST;
+    }
+
+    //大文件用缓存中的fd由write()以sendfile发送(sendfile自带偏移，多个连接可以共享同一fd)；
+    //小文件mmap+writev一次系统调用就能发完，反而更快
+    if (m_transmit_mode == TRANSMIT_SENDFILE && m_file_stat.st_size >= m_sendfile_min_size)
+    {
+        m_file_fd = m_file->fd;
+        m_file_offset = 0;
+        return FILE_REQUEST;
+    }
+
+    m_file_address = file_cache::get_instance()->mapping(m_file);
+    if (!m_file_address && m_file_stat.st_size != 0)
+        return INTERNAL_ERROR;
     return FILE_REQUEST;
 }
 
-void http_conn::unmap()
+//解析"bytes=0-499,1000-,-500"形式的Range头，区间按文件大小裁剪后存入m_ranges
+//返回可满足的区间数；语法错误或区间过多返回0(忽略Range，发送完整文件)，全部不可满足返回-1
+int http_conn::parse_range(const char *text)
 {
-    if (m_file_address)
+    off_t size = m_file_stat.st_size;
+    if (strncasecmp(text, "bytes=", 6) != 0)
+        return 0;
+    text += 6;
+
+    int count = 0;
+    bool any = false;
+    while (*text)
     {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+        text += strspn(text, " \t,");
+        if (!*text)
+            break;
+        any = true;
+
+        char *end;
+        off_t first, last;
+        if (*text == '-')
+        {
+            //后缀区间：最后n个字节
+            off_t n = strtoll(text + 1, &end, 10);
+            if (end == text + 1)
+                return 0;
+            if (n == 0)
+            {
+                text = end;
+                continue;
+            }
+            first = n >= size ? 0 : size - n;
+            last = size - 1;
+        }
+        else
+        {
+            first = strtoll(text, &end, 10);
+            if (end == text || *end != '-')
+                return 0;
+            text = end + 1;
+            last = strtoll(text, &end, 10);
+            if (end == text)
+                last = size - 1;
+            else if (last < first)
+                return 0;
+            if (last >= size)
+                last = size - 1;
+        }
+        text = end;
+        text += strspn(text, " \t");
+        if (*text && *text != ',')
+            return 0;
+
+        if (first >= size)
+            continue;
+        if (count == MAX_RANGES)
+            return 0;
+        m_ranges[count][0] = first;
+        m_ranges[count][1] = last;
+        ++count;
     }
+    if (count == 0)
+        return any ? -1 : 0;
+    return count;
 }
 
+//Accept-Encoding中是否接受coding：列表中出现且q值不为0
+bool http_conn::accept_encoding(const char *coding)
+{
+    size_t coding_len = strlen(coding);
+    const char *p = m_accept_encoding;
+    while (*p)
+    {
+        p += strspn(p, " \t,");
+        size_t len = strcspn(p, " \t,;");
+        bool match = len == coding_len && strncasecmp(p, coding, len) == 0;
+        p += len;
+        p += strspn(p, " \t");
+        //参数部分，只关心q=0
+        bool rejected = false;
+        if (*p == ';')
+        {
+            size_t param_len = strcspn(p, ",");
+            const char *q = strstr(p, "q=");
+            if (q && q < p + param_len)
+                rejected = strtod(q + 2, NULL) == 0;
+            p += param_len;
+        }
+        if (match)
+            return !rejected;
+    }
+    return false;
+}
 
-//向响应缓冲区添加格式化的数据
-bool http_conn::add_response(const char *format,...){
-    if(m_write_idx >= WRITE_BUFFER_SIZE) return false;
+//优先br，其次gzip；预压缩文件不可用时保持原文件
+void http_conn::select_sidecar()
+{
+    const char *suffix = NULL, *encoding = NULL;
+    if ((m_file->sidecars & SIDECAR_BR) && accept_encoding("br"))
+    {
+        suffix = ".br";
+        encoding = "br";
+    }
+    else if ((m_file->sidecars & SIDECAR_GZIP) && accept_encoding("gzip"))
+    {
+        suffix = ".gz";
+        encoding = "gzip";
+    }
+    if (!suffix)
+        return;
 
-    va_list arg_list;
-    va_start(arg_list,format);
+    char path[FILENAME_LEN + 4];
+    snprintf(path, sizeof(path), "%s%s", m_file->path.c_str(), suffix);
+    file_entry *sidecar = file_cache::get_instance()->acquire(path);
+    if (!sidecar || sidecar->fd < 0)
+    {
+        file_cache::get_instance()->release(sidecar);
+        return;
+    }
+    file_cache::get_instance()->release(m_file);
+    m_file = sidecar;
+    m_file_stat = sidecar->st;
+    m_content_encoding = encoding;
+}
 
-    //使用 vsnprintf 将格式化的字符串写入缓冲区：写入位置为 m_write_buf + m_write_idx（缓冲区的当前末尾）。
-    int len = vsnprintf(m_write_buf+m_write_idx, WRITE_BUFFER_SIZE-1-m_write_idx,format,arg_list);
-    
-    //写的位置不够
-    if(len>=(WRITE_BUFFER_SIZE-1-m_write_idx)){
-        va_end(arg_list);
+//优先gzip，其次deflate
+void http_conn::select_compressed()
+{
+    int coding;
+    if (accept_encoding("gzip"))
+        coding = COMPRESS_GZIP;
+    else if (accept_encoding("deflate"))
+        coding = COMPRESS_DEFLATE;
+    else
+        return;
+
+    m_compressed = file_cache::get_instance()->compressed(m_file, coding);
+    if (!m_compressed)
+        return;
+    m_content_encoding = coding == COMPRESS_GZIP ? "gzip" : "deflate";
+    m_etag = m_file->compressed_etag[coding];
+}
+
+//If-Range是强ETag时必须与当前ETag相同，是日期时必须与Last-Modified相同，否则发送完整文件
+bool http_conn::if_range_match()
+{
+    if (m_if_range[0] == '"')
+        return strcmp(m_if_range, m_etag) == 0;
+    return strcmp(m_if_range, m_file->last_modified) == 0;
+}
+
+//If-None-Match优先：列表中任一ETag弱比较相等或为*即未修改；
+//没有If-None-Match时，文件修改时间不晚于If-Modified-Since即未修改。
+//按RFC 9110 13.2.1，304只用于GET/HEAD，其他方法忽略这两个条件头
+bool http_conn::not_modified()
+{
+    if (m_method != GET && m_method != HEAD)
+        return false;
+    if (m_if_none_match)
+    {
+        const char *etag = m_etag;
+        size_t etag_len = strlen(etag);
+        const char *p = m_if_none_match;
+        while (*p)
+        {
+            p += strspn(p, " \t,");
+            if (*p == '*')
+                return true;
+            if (strncmp(p, "W/", 2) == 0)
+                p += 2;
+            size_t len = strcspn(p, " \t,");
+            if (len == etag_len && strncmp(p, etag, len) == 0)
+                return true;
+            p += len;
+        }
         return false;
     }
+    if (m_if_modified_since)
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        if (!strptime(m_if_modified_since, "%a, %d %b %Y %H:%M:%S GMT", &tm))
+            return false;
+        return m_file_stat.st_mtime <= timegm(&tm);
+    }
+    return false;
+}
 
-    //写入成功，更新m_write_idx
-    m_write_idx+=len;
-    va_end(arg_list);
-
-    LOG_INFO("request:%s",m_write_buf);
-    return true;
+//归还当前响应引用的缓存文件，映射和fd由file_cache统一管理
+void http_conn::unmap()
+{
+    if (m_file)
+    {
+        file_cache::get_instance()->release(m_file);
+        m_file = NULL;
+    }
+    m_prebuilt = NULL;
+    m_compressed = NULL;
+    m_file_address = 0;
+    m_file_fd = -1;
 }
 
-bool http_conn::add_status_line(int status,const char *title){
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+
+//响应头直接追加到m_write_buf，状态行来自预先生成的表，Date取线程内按秒缓存的值
+bool http_conn::add_status_line(int status)
+{
+    size_t len;
+    const char *line = status_line(status, &len);
+    if (!line || !m_write_buf.append(line, len))
+        return false;
+    return m_write_buf.append(m_date, date_line(m_date));
 }
 
 
-bool http_conn::add_headers(int content_len)
+bool http_conn::add_headers(off_t content_len)
 {
     return add_content_length(content_len) && add_linger() &&
            add_blank_line();
 }
-bool http_conn::add_content_length(int content_len)
+bool http_conn::add_content_length(off_t content_len)
+{
+    return m_write_buf.append_literal("Content-Length:") && m_write_buf.append_num(content_len) &&
+           m_write_buf.append_literal("\r\n");
+}
+bool http_conn::add_accept_ranges()
 {
-    return add_response("Content-Length:%d\r\n", content_len);
+    return m_write_buf.append_literal("Accept-Ranges:bytes\r\n");
+}
+bool http_conn::add_encoding()
+{
+    if (m_content_encoding && !(m_write_buf.append_literal("Content-Encoding:") &&
+                                m_write_buf.append(m_content_encoding) && m_write_buf.append_literal("\r\n")))
+        return false;
+    if (m_vary)
+        return m_write_buf.append_literal("Vary:Accept-Encoding\r\n");
+    return true;
+}
+bool http_conn::add_validators()
+{
+    return m_write_buf.append_literal("ETag:") && m_write_buf.append(m_etag) &&
+           m_write_buf.append_literal("\r\nLast-Modified:") && m_write_buf.append(m_file->last_modified) &&
+           m_write_buf.append_literal("\r\nCache-Control:max-age=") && m_write_buf.append_num(file_cache::m_max_age) &&
+           m_write_buf.append_literal("\r\n");
+}
+bool http_conn::add_content_range(off_t first, off_t last, off_t size)
+{
+    if (!m_write_buf.append_literal("Content-Range:bytes "))
+        return false;
+    //first < 0 表示416响应的"*/size"形式
+    if (first < 0)
+        m_write_buf.append_literal("*");
+    else
+        m_write_buf.append_num(first) && m_write_buf.append_literal("-") && m_write_buf.append_num(last);
+    return m_write_buf.append_literal("/") && m_write_buf.append_num(size) && m_write_buf.append_literal("\r\n");
 }
 bool http_conn::add_content_type()
 {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    return m_write_buf.append_literal("Content-Type:text/html\r\n");
 }
 bool http_conn::add_linger()
 {
-    return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
+    if (m_linger)
+        return m_write_buf.append_literal("Connection:keep-alive\r\n");
+    return m_write_buf.append_literal("Connection:close\r\n");
 }
 
 
 bool http_conn::add_blank_line()
 {
-    return add_response("%s", "\r\n");
+    return m_write_buf.append_literal("\r\n");
 }
 bool http_conn::add_content(const char *content)
 {
-    return add_response("%s", content);
+    return m_write_buf.append(content);
+}
+
+//错误响应除状态行和Date之外完全固定，按keep-alive预先生成，发送时拼成三段iovec
+bool http_conn::add_error_response(int status)
+{
+    const std::string *rest;
+    switch (status)
+    {
+    case 400: rest = error_400_response; break;
+    case 403: rest = error_403_response; break;
+    case 404: rest = error_404_response; break;
+    case 411: rest = error_411_response; break;
+    case 413: rest = error_413_response; break;
+    default: status = 500; rest = error_500_response; break;
+    }
+    size_t len;
+    m_iv[0].iov_base = (void *)status_line(status, &len);
+    m_iv[0].iov_len = len;
+    m_iv[1].iov_base = m_date;
+    m_iv[1].iov_len = date_line(m_date);
+    m_iv[2].iov_base = (void *)rest[m_linger].data();
+    m_iv[2].iov_len = rest[m_linger].size();
+    m_iv_count = 3;
+    bytes_to_send = m_iv[0].iov_len + m_iv[1].iov_len + m_iv[2].iov_len;
+    return true;
 }
 
 bool http_conn::process_write(HTTP_CODE ret)
@@ -659,41 +1438,78 @@ bool http_conn::process_write(HTTP_CODE ret)
     switch (ret)
     {
     case INTERNAL_ERROR:
-    {
-        add_status_line(500, error_500_title);
-        add_headers(strlen(error_500_form));
-        if (!add_content(error_500_form))
-            return false;
-        break;
-    }
+        return add_error_response(500);
     case BAD_REQUEST:
-    {
-        add_status_line(404, error_404_title);
-        add_headers(strlen(error_404_form));
-        if (!add_content(error_404_form))
-            return false;
-        break;
-    }
+        return add_error_response(400);
+    case NO_RESOURCE:
+        return add_error_response(404);
     case FORBIDDEN_REQUEST:
+        return add_error_response(403);
+    case LENGTH_REQUIRED:
+        return add_error_response(411);
+    case PAYLOAD_TOO_LARGE:
+        return add_error_response(413);
+    case UPLOAD_CREATED:
     {
-        add_status_line(403, error_403_title);
-        add_headers(strlen(error_403_form));
-        if (!add_content(error_403_form))
+        //消息体为保存后的文件名
+        const char *name = strrchr(m_upload_path, '/') + 1;
+        add_status_line(201);
+        m_write_buf.append_literal("Content-Type:text/plain\r\n");
+        add_headers(strlen(name));
+        if (!add_content(name))
             return false;
         break;
     }
     case FILE_REQUEST:
     {
-        add_status_line(200, ok_200_title);
+        if (m_prebuilt)
+        {
+            //预生成响应不含Date，在状态行之后插入当前的Date行
+            size_t len;
+            status_line(200, &len);
+            m_iv[0].iov_base = (void *)m_prebuilt->data();
+            m_iv[0].iov_len = len;
+            m_iv[1].iov_base = m_date;
+            m_iv[1].iov_len = date_line(m_date);
+            m_iv[2].iov_base = (void *)(m_prebuilt->data() + len);
+            m_iv[2].iov_len = m_prebuilt->size() - len;
+            m_iv_count = 3;
+            bytes_to_send = m_prebuilt->size() + m_iv[1].iov_len;
+            return true;
+        }
+        if (m_compressed)
+        {
+            add_status_line(200);
+            add_encoding();
+            add_validators();
+            if (!add_headers(m_compressed->size()))
+                return false;
+            m_iv[0].iov_base = m_write_buf.data();
+            m_iv[0].iov_len = m_write_buf.size();
+            m_iv[1].iov_base = (void *)m_compressed->data();
+            m_iv[1].iov_len = m_compressed->size();
+            m_iv_count = 2;
+            bytes_to_send = m_write_buf.size() + m_compressed->size();
+            return true;
+        }
+        add_status_line(200);
+        add_accept_ranges();
+        add_encoding();
+        add_validators();
         if (m_file_stat.st_size != 0)
         {
             add_headers(m_file_stat.st_size);
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
+            if (m_file_fd >= 0)
+            {
+                bytes_to_send = m_write_buf.size() + m_file_stat.st_size;
+                return true;
+            }
+            m_iv[0].iov_base = m_write_buf.data();
+            m_iv[0].iov_len = m_write_buf.size();
             m_iv[1].iov_base = m_file_address;
             m_iv[1].iov_len = m_file_stat.st_size;
             m_iv_count = 2;
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
+            bytes_to_send = m_write_buf.size() + m_file_stat.st_size;
             return true;
         }
         else
@@ -703,21 +1519,176 @@ bool http_conn::process_write(HTTP_CODE ret)
             if (!add_content(ok_string))
                 return false;
         }
+        break;
+    }
+    case PARTIAL_REQUEST:
+        return add_partial_content();
+    case STREAM_REQUEST:
+    {
+        //长度未知，以chunked编码发送，第一块随响应头一起发出
+        add_status_line(200);
+        add_content_type();
+        m_write_buf.append_literal("Transfer-Encoding:chunked\r\n");
+        if (!add_linger() || !add_blank_line())
+            return false;
+        return add_stream_chunk();
+    }
+    case NOT_MODIFIED:
+    {
+        //304没有消息体，也不带Content-Length
+        add_status_line(304);
+        add_encoding();
+        add_validators();
+        if (!add_linger() || !add_blank_line())
+            return false;
+        break;
+    }
+    case RANGE_NOT_SATISFIABLE:
+    {
+        add_status_line(416);
+        add_content_range(-1, -1, m_file_stat.st_size);
+        if (!add_headers(0))
+            return false;
+        break;
     }
     default:
         return false;
     }
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
+    m_iv[0].iov_base = m_write_buf.data();
+    m_iv[0].iov_len = m_write_buf.size();
+    m_iv_count = 1;
+    bytes_to_send = m_write_buf.size();
+    return true;
+}
+
+//206响应：单区间直接带Content-Range；多区间生成multipart/byteranges，
+//各分段头部放在请求的arena中，与文件映射中的区间交错组成iovec
+bool http_conn::add_partial_content()
+{
+    off_t size = m_file_stat.st_size;
+    add_status_line(206);
+    add_accept_ranges();
+    add_encoding();
+    add_validators();
+
+    if (m_range_count == 1)
+    {
+        off_t first = m_ranges[0][0], last = m_ranges[0][1];
+        add_content_range(first, last, size);
+        if (!add_headers(last - first + 1))
+            return false;
+        bytes_to_send = m_write_buf.size() + (last - first + 1);
+        if (m_file_fd >= 0)
+            return true;
+        m_iv[0].iov_base = m_write_buf.data();
+        m_iv[0].iov_len = m_write_buf.size();
+        m_iv[1].iov_base = m_file_address + first;
+        m_iv[1].iov_len = last - first + 1;
+        m_iv_count = 2;
+        return true;
+    }
+
+    //分段头全部生成在请求的arena中，直到请求结束都不会移动，iovec可以安全地指向它
+    const size_t PART_MAX = 160;
+    char *multipart = (char *)m_arena.alloc((m_range_count + 1) * PART_MAX, 1);
+    if (!multipart)
+        return false;
+    size_t part_pos[MAX_RANGES + 1];
+    size_t multipart_len = 0;
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        part_pos[i] = multipart_len;
+        multipart_len += snprintf(multipart + multipart_len, PART_MAX, "\r\n--%s\r\nContent-Type:application/octet-stream\r\nContent-Range:bytes %lld-%lld/%lld\r\n\r\n",
+                                  range_boundary, (long long)m_ranges[i][0], (long long)m_ranges[i][1], (long long)size);
+    }
+    part_pos[m_range_count] = multipart_len;
+    multipart_len += snprintf(multipart + multipart_len, PART_MAX, "\r\n--%s--\r\n", range_boundary);
+
+    off_t body_len = multipart_len;
+    for (int i = 0; i < m_range_count; ++i)
+        body_len += m_ranges[i][1] - m_ranges[i][0] + 1;
+
+    m_write_buf.append_literal("Content-Type:multipart/byteranges; boundary=");
+    m_write_buf.append(range_boundary);
+    m_write_buf.append_literal("\r\n");
+    if (!add_headers(body_len))
+        return false;
+
+    m_iv[0].iov_base = m_write_buf.data();
+    m_iv[0].iov_len = m_write_buf.size();
     m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        m_iv[m_iv_count].iov_base = multipart + part_pos[i];
+        m_iv[m_iv_count++].iov_len = part_pos[i + 1] - part_pos[i];
+        m_iv[m_iv_count].iov_base = m_file_address + m_ranges[i][0];
+        m_iv[m_iv_count++].iov_len = m_ranges[i][1] - m_ranges[i][0] + 1;
+    }
+    m_iv[m_iv_count].iov_base = multipart + part_pos[m_range_count];
+    m_iv[m_iv_count++].iov_len = multipart_len - part_pos[m_range_count];
+    bytes_to_send = m_write_buf.size() + body_len;
     return true;
 }
 
+//调用生成函数追加一块chunked数据：先占位8位十六进制长度，生成后回填，内容不需要再拷贝一次；
+//生成函数表示结束时追加末块，之后按普通响应收尾
+bool http_conn::add_stream_chunk()
+{
+    size_t head = m_write_buf.size();
+    if (!m_write_buf.append_literal("00000000\r\n"))
+        return false;
+    size_t start = m_write_buf.size();
+    bool more = m_stream(m_url, &m_stream_state, m_write_buf);
+    size_t len = m_write_buf.size() - start;
+    if (len == 0)
+        m_write_buf.truncate(head);
+    else
+    {
+        char *p = m_write_buf.data() + head + 8;
+        for (size_t n = len; n; n >>= 4)
+            *--p = "0123456789abcdef"[n & 15];
+        if (!m_write_buf.append_literal("\r\n"))
+            return false;
+    }
+    if (!more)
+    {
+        m_stream = NULL;
+        if (!m_write_buf.append_literal("0\r\n\r\n"))
+            return false;
+    }
+    m_iv[0].iov_base = m_write_buf.data();
+    m_iv[0].iov_len = m_write_buf.size();
+    m_iv_count = 1;
+    bytes_to_send = m_write_buf.size();
+    return true;
+}
+
+//writev部分发送后，按已发送的字节数依次推进各个iovec
+void http_conn::advance_iov(size_t sent)
+{
+    for (int i = 0; i < m_iv_count && sent > 0; ++i)
+    {
+        size_t n = sent < m_iv[i].iov_len ? sent : m_iv[i].iov_len;
+        m_iv[i].iov_base = (char *)m_iv[i].iov_base + n;
+        m_iv[i].iov_len -= n;
+        sent -= n;
+    }
+}
+
+//sendfile模式：响应头带MSG_MORE发送，内核会把它和随后的文件数据合并成满MSS的报文；
+//文件部分由sendfile直接从页缓存发往socket，不经过用户态，也不需要mmap/munmap
+ssize_t http_conn::write_sendfile()
+{
+    if (bytes_have_send < (off_t)m_write_buf.size())
+        return send(m_sockfd, m_write_buf.data() + bytes_have_send, m_write_buf.size() - bytes_have_send, MSG_MORE);
+    return sendfile(m_sockfd, m_file_fd, &m_file_offset, bytes_to_send);
+}
+
 bool http_conn::write(){
-    int temp = 0;
+    ssize_t temp = 0;
+    int stream_chunks = 0;
 
-    if (bytes_to_send == 0)
+    if (bytes_to_send == 0 && !m_stream)
     {
         modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
         init();
@@ -726,7 +1697,10 @@ bool http_conn::write(){
 
     while (1)
     {
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        if (m_file_fd >= 0)
+            temp = write_sendfile();
+        else
+            temp = writev(m_sockfd, m_iv, m_iv_count);
 
         if (temp < 0)
         {
@@ -738,33 +1712,59 @@ bool http_conn::write(){
             unmap();
             return false;
         }
+        //文件在发送过程中被截断，sendfile读不到数据
+        if (temp == 0 && m_file_fd >= 0)
+        {
+            unmap();
+            return false;
+        }
 
         bytes_have_send += temp;
         bytes_to_send -= temp;
-        if (bytes_have_send >= m_iv[0].iov_len)
-        {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        }
-        else
-        {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
-        }
+        //sendfile模式的进度由bytes_have_send和m_file_offset记录，不使用m_iv
+        if (m_file_fd < 0)
+            advance_iov(temp);
 
         if (bytes_to_send <= 0)
         {
+            //流式响应：上一块发完后生成下一块，连续生成若干块后让出工作线程，等下次可写再继续
+            if (m_stream)
+            {
+                m_write_buf.clear();
+                if (!add_stream_chunk())
+                {
+                    unmap();
+                    return false;
+                }
+                if (++stream_chunks >= STREAM_CHUNKS_PER_WRITE)
+                {
+                    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+                    return true;
+                }
+                continue;
+            }
             unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
 
             if (m_linger)
             {
-                init();
+                //缓冲区里已有下一个请求时直接处理并继续发送，按到达顺序逐个响应
+                init_pipelined();
+                if (m_read_idx > 0)
+                {
+                    HTTP_CODE read_ret = process_read();
+                    if (read_ret != NO_REQUEST)
+                    {
+                        if (!process_write(read_ret))
+                            return false;
+                        continue;
+                    }
+                }
+                modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
                 return true;
             }
             else
             {
+                modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
                 return false;
             }
         }
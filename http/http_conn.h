@@ -19,20 +19,42 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <string>
 #include <map>
+#include <atomic>
 
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
+#include "read_buffer.h"
+#include "line_scanner.h"
+#include "file_cache.h"
+#include "response_builder.h"
+#include "router.h"
+#include "header_table.h"
+#include "arena.h"
+#include "form_decoder.h"
+#include "user_cache.h"
 
 class http_conn
 {
 public:
     // 常量定义
     static const int FILENAME_LEN = 200;        // 文件名最大长度
-    static const int READ_BUFFER_SIZE = 2048;   // 读缓冲区大小
-    static const int WRITE_BUFFER_SIZE = 1024;  // 写缓冲区大小
+    static const int MAX_RANGES = 8;            // 一个Range请求最多支持的区间数
+    static const int MAX_IOV = 2 * MAX_RANGES + 2;  // 响应头 + 每个区间的分段头和数据 + 结束分隔符
+    static const int STREAM_CHUNKS_PER_WRITE = 16;  // 流式响应一次write()最多生成的块数
+    static const long UPLOAD_BYTES_PER_READ = 1024 * 1024;  // 上传一次可读事件最多搬运的字节数
+    static const int MAX_CREDENTIAL_LEN = 99;   // 登录/注册表单中用户名、密码的最大长度
+
+    // 静态文件的发送方式
+    enum TRANSMIT_MODE
+    {
+        TRANSMIT_MMAP = 0,  // mmap + writev
+        TRANSMIT_SENDFILE   // 响应头send(MSG_MORE) + 文件sendfile
+    };
 
     // HTTP请求方法枚举
     enum METHOD
@@ -66,7 +88,23 @@ public:
         FORBIDDEN_REQUEST,   // 客户对资源没有足够的访问权限
         FILE_REQUEST,        // 文件请求,获取文件成功
         INTERNAL_ERROR,      // 服务器内部错误
-        CLOSED_CONNECTION    // 客户端已经关闭连接
+        CLOSED_CONNECTION,   // 客户端已经关闭连接
+        PARTIAL_REQUEST,     // Range请求，返回206部分内容
+        NOT_MODIFIED,        // 条件请求命中，返回304
+        RANGE_NOT_SATISFIABLE, // Range中没有可满足的区间，返回416
+        STREAM_REQUEST,        // 流式生成的内容，以chunked编码发送
+        UPLOAD_CREATED,        // 上传已写入暂存目录，返回201
+        LENGTH_REQUIRED,       // 上传没有Content-Length，返回411
+        PAYLOAD_TOO_LARGE      // 上传或消息体超过大小上限，返回413
+    };
+
+    // chunked请求体的解码状态
+    enum CHUNK_STATE
+    {
+        CHUNK_SIZE = 0,   // 等待"大小[;扩展]\r\n"行
+        CHUNK_DATA,       // 正在接收块数据
+        CHUNK_DATA_END,   // 块数据之后的\r\n
+        CHUNK_TRAILER     // 大小为0的末块之后的trailer，直到空行
     };
 
     // 从状态机的三种可能状态，即行的读取状态
@@ -78,7 +116,7 @@ public:
     };
 
 public:
-    http_conn() {}
+    http_conn() : m_sockfd(-1) {}
     ~http_conn() {}
 
 public:
@@ -102,6 +140,13 @@ public:
     }
     // 初始化数据库结果
     void initmysql_result(connection_pool *connPool);
+    // 当前占用的内存：对象本身 + 正在使用的缓冲区；空闲的keep-alive连接只有对象本身
+    size_t resident_bytes() const;
+    // 统计conns[0, n)中打开的连接数、正在处理请求的连接数和总内存，写入日志
+    static void report_memory(const http_conn *conns, int n);
+    // 启用上传：PUT/POST到/upload或/upload/<name>的请求体写入spool_dir，单个上传不超过max_size字节；
+    // GET /uploads以流式响应列出已上传的文件
+    static void init_upload(const char *spool_dir, long max_size);
     
     // 定时器相关
     int timer_flag;
@@ -110,6 +155,10 @@ public:
 private:
     // 初始化连接
     void init();
+    // keep-alive下保留已读入的流水线请求，重置解析状态
+    void init_pipelined();
+    // 重置单个请求的状态
+    void reset_request();
 
     // 从m_read_buf读取，解析HTTP请求
     HTTP_CODE process_read();
@@ -122,26 +171,53 @@ private:
     HTTP_CODE parse_request_line(char *text);
     HTTP_CODE parse_headers(char *text);
     HTTP_CODE parse_content(char *text);
+    HTTP_CODE parse_chunked();
     HTTP_CODE do_request();//生成响应报文
+    const char *handle_user_form(bool is_register);
     /*从状态机*/
-    char *get_line() { return m_read_buf + m_start_line; };
+    char *get_line() { return m_read_buf.data() + m_start_line; };
     LINE_STATUS parse_line();
 
     // 这一组函数被process_write调用以填充HTTP应答
     void unmap();
-    bool add_response(const char *format, ...);
+    ssize_t write_sendfile();
+    void advance_iov(size_t sent);
+    // 读缓冲区升级后，把指向旧缓冲区的解析结果平移到新缓冲区
+    void rebase(char *old_base);
     bool add_content(const char *content);
-    bool add_status_line(int status, const char *title);
-    bool add_headers(int content_length);
+    bool add_status_line(int status);
+    bool add_error_response(int status);
+    bool add_headers(off_t content_length);
     bool add_content_type();
-    bool add_content_length(int content_length);
+    bool add_content_length(off_t content_length);
+    bool add_accept_ranges();
+    bool add_content_range(off_t first, off_t last, off_t size);
+    bool add_partial_content();
+    int parse_range(const char *text);
+    bool if_range_match();
+    bool not_modified();
+    bool add_validators();
+    bool accept_encoding(const char *coding);
+    void select_sidecar();
+    void select_compressed();
+    bool add_encoding();
     bool add_linger();
+    bool add_stream_chunk();
+    HTTP_CODE begin_upload();
+    HTTP_CODE finish_upload();
+    bool read_upload();
+    void end_upload();
     bool add_blank_line();
 
 public:
     static int m_epollfd;       // 所有socket上的事件都被注册到同一个epoll内核事件表中，所以设置成静态的
     static int m_user_count;    // 统计用户数量
-    MYSQL *mysql;               // 数据库连接
+    static int m_transmit_mode;         // 静态文件发送方式，由配置设置，默认TRANSMIT_SENDFILE
+    static long m_sendfile_min_size;    // sendfile模式下小于该大小的文件仍走mmap+writev
+    static long m_prebuilt_max_size;    // 不超过该大小的文件使用预先拼好的完整响应
+    static std::string m_spool_dir;     // 上传暂存目录，空表示未启用上传
+    static long m_upload_max_size;      // 单个上传的大小上限
+    static std::atomic<long> m_db_requests;  // 实际访问过数据库的请求数
     int m_state;                // 读为0, 写为1
 
 private:
@@ -149,8 +225,8 @@ private:
     int m_sockfd;
     sockaddr_in m_address;
 
-    // 读缓冲区
-    char m_read_buf[READ_BUFFER_SIZE];
+    // 读缓冲区，内联头部+按需升级的池化块
+    read_buffer m_read_buf;
     // 标识读缓冲中已经读入的客户数据的最后一个字节的下一个位置
     long m_read_idx;
     // 当前正在分析的字符在读缓冲区中的位置
@@ -158,10 +234,12 @@ private:
     // 当前正在解析的行的起始位置  
     int m_start_line;
 
-    // 写缓冲区
-    char m_write_buf[WRITE_BUFFER_SIZE];
-    // 写缓冲区中待发送的字节数
-    int m_write_idx;
+    // 请求级分配器，只用于多段Range响应的分段头和上传路径，reset_request()时整体归还
+    arena m_arena;
+    // 写缓冲区，存放拼好的响应头(及小的消息体)
+    response_builder m_write_buf;
+    // 本次响应的Date行，writev分段发送期间需要保持不变
+    char m_date[40];
 
     // 主状态机当前所处的状态
     CHECK_STATE m_check_state;
@@ -169,8 +247,6 @@ private:
     METHOD m_method;
 
     /*请求报文解析信息*/
-    // 客户请求的目标文件的完整路径，其内容等于doc_root + m_url, doc_root是网站根目录
-    char m_real_file[FILENAME_LEN];
     // 客户请求的目标文件的文件名
     char *m_url;
     // HTTP协议版本号，我们仅支持HTTP/1.1
@@ -179,30 +255,74 @@ private:
     char *m_host;
     // HTTP请求的消息体的长度
     long m_content_length;
+    // 消息体末尾被'\0'覆盖的字节，流水线请求需要还原
+    char m_content_tail;
     // HTTP请求是否要求保持连接
     bool m_linger;
 
+    // 当前响应引用的缓存文件
+    file_entry *m_file;
+    // 小文件的预生成完整响应，指向m_file内部
+    const std::string *m_prebuilt;
     // 客户请求的目标文件被mmap到内存中的起始位置
     char *m_file_address;
     // 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
     struct stat m_file_stat;
     // 我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写内存块的数量。
-    struct iovec m_iv[2];
+    struct iovec m_iv[MAX_IOV];
     int m_iv_count;
+    // 全部请求头，指向读缓冲区
+    header_table m_headers;
+    // Range请求：原始头部值、If-Range值，以及解析出的闭区间[起点, 终点]
+    char *m_range;
+    char *m_if_range;
+    // 条件GET的If-None-Match和If-Modified-Since值
+    char *m_if_none_match;
+    char *m_if_modified_since;
+    // Accept-Encoding值；选中的预压缩编码(NULL为原文件)；文件存在多个编码版本时响应需带Vary
+    char *m_accept_encoding;
+    const char *m_content_encoding;
+    bool m_vary;
+    // 当前发送的表示对应的ETag
+    const char *m_etag;
+    // 运行时压缩的内容，指向m_file内部
+    const std::string *m_compressed;
+    off_t m_ranges[MAX_RANGES][2];
+    int m_range_count;
+    // sendfile模式下使用的缓存文件描述符(-1表示未使用)及下一次发送的文件偏移
+    int m_file_fd;
+    off_t m_file_offset;
+
+    // Transfer-Encoding: chunked的请求体，在读缓冲区内原地解码，解码结果从m_body_start开始连续存放
+    bool m_chunked;
+    CHUNK_STATE m_chunk_state;
+    long m_chunk_left;   // 当前块还未收到的字节数
+    long m_body_start;   // 消息体在读缓冲区中的起始位置
+    long m_body_len;     // 已解码的字节数
+    // 流式响应的生成函数及其进度
+    stream_producer m_stream;
+    long m_stream_state;
+
+    // 上传：请求体经管道splice到暂存文件，不经过用户态；进度保存在连接中，工作线程不会被一个上传占住
+    int m_upload_fd;            // 正在写入的暂存文件，-1表示没有上传
+    int m_upload_pipe[2];       // socket -> 管道 -> 文件
+    long m_upload_left;         // 还未从socket收到的字节数
+    char *m_upload_path;        // 完成后的文件路径
+    char *m_upload_tmp_path;    // 写入期间使用的暂存路径
 
     int cgi;        // 是否启用的POST
     char *m_string; // 存储请求头数据
-    int bytes_to_send;  // 剩余发送字节数
-    int bytes_have_send;  // 已发送字节数
+    off_t bytes_to_send;  // 剩余发送字节数，文件可能超过2GB，用off_t
+    off_t bytes_have_send;  // 已发送字节数
     char *doc_root;  // 网站根目录
 
-    map<string, string> m_users;  // 用户名和密码
     int m_TRIGMode;  // 触发模式
     int m_close_log;  // 是否关闭日志
 
-    char sql_user[100];  // 数据库用户名
-    char sql_passwd[100];  // 数据库密码
-    char sql_name[100];  // 数据库名
+    // 数据库用户名、密码和库名，所有连接共用一份
+    static std::string m_sql_user;
+    static std::string m_sql_passwd;
+    static std::string m_sql_name;
 };
 
 #endif
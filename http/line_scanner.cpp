@@ -0,0 +1,112 @@
+#include "line_scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LINE_SCANNER_X86 1
+#endif
+
+//逐字节扫描，用于尾部不足一个向量的部分以及非x86平台
+static size_t find_crlf_scalar(const char *p, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (p[i] == '\r' || p[i] == '\n')
+            return i;
+    }
+    return len;
+}
+
+#ifdef LINE_SCANNER_X86
+
+//一次比较16字节，把等于'\r'或'\n'的位置压成掩码，掩码最低位即第一个命中
+__attribute__((target("sse2")))
+static size_t find_crlf_sse2(const char *p, size_t len)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + find_crlf_scalar(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_crlf_avx2(const char *p, size_t len)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + find_crlf_sse2(p + i, len - i);
+}
+
+typedef size_t (*find_crlf_fn)(const char *, size_t);
+
+//启动时根据CPU能力选定实现，之后每次调用只是一次间接跳转
+static find_crlf_fn select_find_crlf()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return find_crlf_avx2;
+    return find_crlf_sse2;
+}
+
+static find_crlf_fn g_find_crlf = select_find_crlf();
+
+size_t find_crlf(const char *p, size_t len)
+{
+    //请求行和大多数头部都很短，不足一个向量时直接逐字节扫描
+    if (len < 16)
+        return find_crlf_scalar(p, len);
+    return g_find_crlf(p, len);
+}
+
+bool find_crlf_use(FIND_CRLF_IMPL impl)
+{
+    switch (impl)
+    {
+    case FIND_CRLF_AUTO:
+        g_find_crlf = select_find_crlf();
+        return true;
+    case FIND_CRLF_SCALAR:
+        g_find_crlf = find_crlf_scalar;
+        return true;
+    case FIND_CRLF_SSE2:
+        g_find_crlf = find_crlf_sse2;
+        return true;
+    case FIND_CRLF_AVX2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2"))
+            return false;
+        g_find_crlf = find_crlf_avx2;
+        return true;
+    }
+    return false;
+}
+
+#else
+
+size_t find_crlf(const char *p, size_t len)
+{
+    return find_crlf_scalar(p, len);
+}
+
+bool find_crlf_use(FIND_CRLF_IMPL impl)
+{
+    return impl == FIND_CRLF_AUTO || impl == FIND_CRLF_SCALAR;
+}
+
+#endif
@@ -0,0 +1,22 @@
+//向量化的行结束符查找：在一段缓冲区中找第一个'\r'或'\n'
+//x86上以SSE2为基线，运行时检测到AVX2则切换到32字节版本；其他平台退回逐字节扫描
+#ifndef LINE_SCANNER_H
+#define LINE_SCANNER_H
+
+#include <stddef.h>
+
+//返回[p, p + len)中第一个'\r'或'\n'的下标，没有则返回len
+size_t find_crlf(const char *p, size_t len);
+
+//find_crlf()背后的实现，默认由启动时的CPU检测决定
+enum FIND_CRLF_IMPL
+{
+    FIND_CRLF_AUTO,
+    FIND_CRLF_SCALAR,
+    FIND_CRLF_SSE2,
+    FIND_CRLF_AVX2
+};
+//强制切换实现，供基准测试对比；CPU或平台不支持时返回false且不切换。不是线程安全的，只能在处理请求前调用
+bool find_crlf_use(FIND_CRLF_IMPL impl);
+
+#endif
@@ -0,0 +1,132 @@
+#include <errno.h>
+#include "read_buffer.h"
+
+/*--------------------------------buffer_pool--------------------------------*/
+
+buffer_pool::~buffer_pool()
+{
+    for (int i = 0; i < CLASS_NUM; ++i)
+    {
+        for (size_t j = 0; j < m_free[i].size(); ++j)
+            delete[] m_free[i][j];
+        m_free[i].clear();
+    }
+}
+
+//返回能容纳size字节的最小级别，超过最大级别返回-1
+int buffer_pool::size_class(size_t size)
+{
+    size_t block = MIN_BLOCK;
+    for (int i = 0; i < CLASS_NUM; ++i, block <<= 1)
+    {
+        if (size <= block)
+            return i;
+    }
+    return -1;
+}
+
+char *buffer_pool::alloc(size_t &size)
+{
+    int idx = size_class(size);
+    if (idx < 0)
+        return NULL;
+    size = (size_t)MIN_BLOCK << idx;
+
+    char *block = NULL;
+    m_lock.lock();
+    if (!m_free[idx].empty())
+    {
+        block = m_free[idx].back();
+        m_free[idx].pop_back();
+    }
+    m_lock.unlock();
+
+    if (!block)
+        block = new char[size];
+    return block;
+}
+
+void buffer_pool::free(char *block, size_t size)
+{
+    int idx = size_class(size);
+    if (!block || idx < 0)
+        return;
+
+    m_lock.lock();
+    if ((int)m_free[idx].size() < MAX_CACHED)
+    {
+        m_free[idx].push_back(block);
+        block = NULL;
+    }
+    m_lock.unlock();
+
+    //缓存已满，直接还给系统
+    delete[] block;
+}
+
+/*--------------------------------read_buffer--------------------------------*/
+
+bool read_buffer::reserve(size_t used, size_t need)
+{
+    if (need <= m_cap)
+        return true;
+    if (need > (size_t)MAX_SIZE)
+        return false;
+
+    size_t size = need;
+    char *block = buffer_pool::get_instance()->alloc(size);
+    if (!block)
+        return false;
+
+    if (m_data)
+    {
+        memcpy(block, m_data, used);
+        buffer_pool::get_instance()->free(m_data, m_cap);
+    }
+    m_data = block;
+    m_cap = size;
+    return true;
+}
+
+ssize_t read_buffer::read_fd(int fd, size_t used)
+{
+    //溢出区放在栈上，每个工作线程一份，不占用连接对象的内存
+    char extra[MAX_SIZE];
+    size_t writable = m_cap ? m_cap - used - 1 : 0;
+    //两段合计不超过MAX_SIZE-1，读满后加上结尾'\0'仍能放进最大的块
+    size_t overflow = MAX_SIZE - 1 - used - writable;
+
+    struct iovec vec[2];
+    vec[0].iov_base = m_data + used;
+    vec[0].iov_len = writable;
+    vec[1].iov_base = extra;
+    vec[1].iov_len = overflow;
+    int iovcnt = overflow > 0 ? 2 : 1;
+
+    ssize_t n = readv(fd, vec, iovcnt);
+    if (n <= 0)
+        return n;
+
+    //溢出到栈上的数据搬到升级后的块中
+    if ((size_t)n > writable)
+    {
+        if (!reserve(used + writable, used + n + 1))
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        memcpy(m_data + used + writable, extra, n - writable);
+    }
+    m_data[used + n] = '\0';
+    return n;
+}
+
+void read_buffer::release()
+{
+    if (m_data)
+    {
+        buffer_pool::get_instance()->free(m_data, m_cap);
+        m_data = NULL;
+        m_cap = 0;
+    }
+}
@@ -0,0 +1,70 @@
+//可增长的读缓冲区：只在有数据时从内存池借用块，按需升级为更大的块
+//空闲连接不占用缓冲区内存，请求处理完、缓冲区中没有剩余数据时归还
+#ifndef READ_BUFFER_H
+#define READ_BUFFER_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string.h>
+#include <vector>
+#include "../lock/locker.h"
+
+//按大小分级(4K,8K,...,64K)缓存内存块的全局池，所有连接共享
+class buffer_pool
+{
+public:
+    static const int MIN_BLOCK = 4096;  //最小块大小
+    static const int CLASS_NUM = 5;     //大小级别数量，最大块为 MIN_BLOCK << (CLASS_NUM - 1)
+    static const int MAX_CACHED = 64;   //每个级别最多缓存的空闲块数
+
+    static buffer_pool *get_instance()
+    {
+        static buffer_pool instance;
+        return &instance;
+    }
+
+    //分配至少size字节的块，size被改写为实际块大小；超过最大级别返回NULL
+    char *alloc(size_t &size);
+    //归还块，size必须是alloc返回的块大小
+    void free(char *block, size_t size);
+
+private:
+    buffer_pool() {}
+    ~buffer_pool();
+    static int size_class(size_t size);
+
+    std::vector<char *> m_free[CLASS_NUM];  //各级别的空闲块
+    locker m_lock;
+};
+
+class read_buffer
+{
+public:
+    static const int MAX_SIZE = 65536;    //单个请求允许的最大字节数
+
+    read_buffer() : m_data(NULL), m_cap(0) {}
+    ~read_buffer() { release(); }
+
+    char *data() { return m_data; }
+    size_t capacity() const { return m_cap; }
+
+    //用一次readv从fd读取数据追加到前used字节之后：
+    //第一段是当前块的剩余空间(还没有块时为空)，第二段是栈上的溢出区，溢出时借用或升级为更大的池化块
+    //used必须小于MAX_SIZE-1；返回值同readv；数据末尾始终保留一个'\0'
+    ssize_t read_fd(int fd, size_t used);
+
+    //保证至少能容纳need字节(含结尾'\0')，保留前used字节的内容
+    bool reserve(size_t used, size_t need);
+
+    //归还池化块
+    void release();
+
+private:
+    read_buffer(const read_buffer &);
+    read_buffer &operator=(const read_buffer &);
+
+    char *m_data;  //池化块，没有数据时为NULL
+    size_t m_cap;  //m_data的容量
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include <time.h>
+#include "response_builder.h"
+
+/*-----------------------------response_builder------------------------------*/
+
+void response_builder::clear()
+{
+    if (m_data)
+    {
+        buffer_pool::get_instance()->free(m_data, m_cap);
+        m_data = NULL;
+        m_cap = 0;
+    }
+    m_len = 0;
+}
+
+bool response_builder::grow(size_t need)
+{
+    if (need > (size_t)MAX_SIZE)
+        return false;
+    size_t size = need;
+    char *block = buffer_pool::get_instance()->alloc(size);
+    if (!block)
+        return false;
+    if (m_data)
+    {
+        memcpy(block, m_data, m_len);
+        buffer_pool::get_instance()->free(m_data, m_cap);
+    }
+    m_data = block;
+    m_cap = size;
+    return true;
+}
+
+bool response_builder::append_num(long long v)
+{
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+    unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    do
+    {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (v < 0)
+        *--p = '-';
+    return append(p, tmp + sizeof(tmp) - p);
+}
+
+/*-------------------------------状态行与Date--------------------------------*/
+
+#define STATUS_LINE(code, title) "HTTP/1.1 " #code " " title "\r\n"
+
+const char *status_line(int status, size_t *len)
+{
+    const char *line;
+    switch (status)
+    {
+    case 200: line = STATUS_LINE(200, "OK"); break;
+    case 201: line = STATUS_LINE(201, "Created"); break;
+    case 206: line = STATUS_LINE(206, "Partial Content"); break;
+    case 304: line = STATUS_LINE(304, "Not Modified"); break;
+    case 400: line = STATUS_LINE(400, "Bad Request"); break;
+    case 403: line = STATUS_LINE(403, "Forbidden"); break;
+    case 404: line = STATUS_LINE(404, "Not Found"); break;
+    case 411: line = STATUS_LINE(411, "Length Required"); break;
+    case 413: line = STATUS_LINE(413, "Payload Too Large"); break;
+    case 416: line = STATUS_LINE(416, "Range Not Satisfiable"); break;
+    case 500: line = STATUS_LINE(500, "Internal Error"); break;
+    default: return NULL;
+    }
+    *len = strlen(line);
+    return line;
+}
+
+//每个线程各自缓存，秒数变化时才重新strftime，读写都不需要加锁
+size_t date_line(char *buf)
+{
+    static __thread time_t cached_sec = 0;
+    static __thread char cached[40];
+    static __thread size_t cached_len = 0;
+
+    time_t now = time(NULL);
+    if (now != cached_sec)
+    {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        cached_len = strftime(cached, sizeof(cached), "Date:%a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        cached_sec = now;
+    }
+    memcpy(buf, cached, cached_len);
+    return cached_len;
+}
@@ -0,0 +1,59 @@
+//响应头构造：可增长的写缓冲区，头部用直接追加的方式生成，不经过vsnprintf
+//缓冲区在第一次追加时才从buffer_pool借用，clear()时归还，空闲连接不占用
+//状态行按状态码预先生成，Date头每个线程每秒只格式化一次
+#ifndef RESPONSE_BUILDER_H
+#define RESPONSE_BUILDER_H
+
+#include <string.h>
+#include <stddef.h>
+#include "read_buffer.h"
+
+class response_builder
+{
+public:
+    static const int MAX_SIZE = 65536;    //超过后追加失败
+
+    response_builder() : m_data(NULL), m_len(0), m_cap(0) {}
+    ~response_builder() { clear(); }
+
+    char *data() { return m_data; }
+    size_t size() const { return m_len; }
+    size_t capacity() const { return m_cap; }
+
+    //清空内容，归还池化块
+    void clear();
+    //截短到len字节，len不超过当前长度
+    void truncate(size_t len) { m_len = len; }
+
+    bool append(const char *s, size_t n)
+    {
+        if (m_len + n > m_cap && !grow(m_len + n))
+            return false;
+        memcpy(m_data + m_len, s, n);
+        m_len += n;
+        return true;
+    }
+    bool append(const char *s) { return append(s, strlen(s)); }
+    //字符串字面量在编译期确定长度
+    template <size_t N>
+    bool append_literal(const char (&s)[N]) { return append(s, N - 1); }
+    //十进制整数，逆序写入临时区再整体追加
+    bool append_num(long long v);
+
+private:
+    response_builder(const response_builder &);
+    response_builder &operator=(const response_builder &);
+    bool grow(size_t need);
+
+    char *m_data;  //池化块，未使用时为NULL
+    size_t m_len;
+    size_t m_cap;
+};
+
+//预先生成的"HTTP/1.1 <code> <title>\r\n"，未知状态码返回NULL
+const char *status_line(int status, size_t *len);
+
+//"Date:<IMF-fixdate>\r\n"，写入buf(至少40字节)并返回长度；每个线程每秒只格式化一次
+size_t date_line(char *buf);
+
+#endif
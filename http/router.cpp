@@ -0,0 +1,118 @@
+#include <algorithm>
+#include "router.h"
+
+/*-------------------------------内置路由---------------------------------*/
+
+//页面上的按钮和表单提交到这些路径，见root目录下的html
+static constexpr route builtin_routes[] = {
+    {"/", ROUTE_PAGE, "/judge.html", NULL},
+    {"/0", ROUTE_PAGE, "/register.html", NULL},
+    {"/1", ROUTE_PAGE, "/log.html", NULL},
+    {"/5", ROUTE_PAGE, "/picture.html", NULL},
+    {"/6", ROUTE_PAGE, "/video.html", NULL},
+    {"/7", ROUTE_PAGE, "/fans.html", NULL},
+    {"/2CGISQL.cgi", ROUTE_LOGIN, NULL, NULL},
+    {"/3CGISQL.cgi", ROUTE_REGISTER, NULL, NULL},
+};
+static constexpr int BUILTIN_NUM = sizeof(builtin_routes) / sizeof(builtin_routes[0]);
+
+//FNV-1a，种子参与初始值；增加内置路由后若下面的static_assert失败，换一个种子即可
+static constexpr uint32_t ROUTE_HASH_SEED = 1;
+static constexpr int ROUTE_SLOTS = 16;
+
+static constexpr uint32_t route_hash(std::string_view s)
+{
+    uint32_t h = 2166136261u ^ ROUTE_HASH_SEED;
+    for (char c : s)
+    {
+        h ^= (unsigned char)c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+struct route_slots
+{
+    int8_t index[ROUTE_SLOTS];  //槽位 -> builtin_routes下标，-1为空
+    bool perfect;               //没有两个路由落在同一槽位
+};
+
+static constexpr route_slots build_slots()
+{
+    route_slots t = {};
+    t.perfect = true;
+    for (int i = 0; i < ROUTE_SLOTS; ++i)
+        t.index[i] = -1;
+    for (int i = 0; i < BUILTIN_NUM; ++i)
+    {
+        int slot = route_hash(builtin_routes[i].path) % ROUTE_SLOTS;
+        if (t.index[slot] != -1)
+            t.perfect = false;
+        t.index[slot] = i;
+    }
+    return t;
+}
+
+static constexpr route_slots builtin_slots = build_slots();
+static_assert(builtin_slots.perfect, "builtin routes collide, change ROUTE_HASH_SEED");
+
+/*-------------------------------router---------------------------------*/
+
+router::~router()
+{
+    for (size_t i = 0; i < m_routes.size(); ++i)
+        delete m_routes[i];
+}
+
+void router::add(const char *path, bool prefix, ROUTE_ACTION action, const char *page, stream_producer stream)
+{
+    dynamic_route *d = new dynamic_route;
+    d->path = path;
+    d->page = page ? page : "";
+    d->r.path = d->path;
+    d->r.action = action;
+    d->r.page = page ? d->page.c_str() : NULL;
+    d->r.stream = stream;
+    m_routes.push_back(d);
+
+    if (!prefix)
+    {
+        m_exact[d->r.path] = &d->r;
+        return;
+    }
+    for (size_t i = 0; i < m_prefix.size(); ++i)
+    {
+        if (m_prefix[i]->path == d->r.path)
+        {
+            m_prefix[i] = &d->r;
+            return;
+        }
+    }
+    m_prefix.push_back(&d->r);
+    std::stable_sort(m_prefix.begin(), m_prefix.end(), [](const route *a, const route *b)
+                     { return a->path.size() > b->path.size(); });
+}
+
+const route *router::match(std::string_view url) const
+{
+    int i = builtin_slots.index[route_hash(url) % ROUTE_SLOTS];
+    if (i >= 0 && builtin_routes[i].path == url)
+        return &builtin_routes[i];
+    //没有注册额外路由时不必再查
+    if (m_routes.empty())
+        return NULL;
+    return match_dynamic(url);
+}
+
+const route *router::match_dynamic(std::string_view url) const
+{
+    std::unordered_map<std::string_view, const route *>::const_iterator it = m_exact.find(url);
+    if (it != m_exact.end())
+        return it->second;
+    for (size_t i = 0; i < m_prefix.size(); ++i)
+    {
+        if (url.compare(0, m_prefix[i]->path.size(), m_prefix[i]->path) == 0)
+            return m_prefix[i];
+    }
+    return NULL;
+}
@@ -0,0 +1,71 @@
+//URL路由表：把请求路径映射到处理方式(静态文件、固定页面、登录、注册)
+//内置路由在编译期生成完美哈希表，查找是一次哈希加一次比较；
+//运行时注册的路由放在另一层，支持精确匹配和最长前缀匹配；查找过程不分配内存
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+enum ROUTE_ACTION
+{
+    ROUTE_STATIC = 0,  //按URL发送静态文件
+    ROUTE_PAGE,        //内部重定向到固定页面
+    ROUTE_LOGIN,       //POST登录表单，按结果返回welcome/logError页面
+    ROUTE_REGISTER,    //POST注册表单，按结果返回log/registerError页面
+    ROUTE_STREAM,      //由生成函数边生成边以chunked编码发送
+    ROUTE_UPLOAD       //PUT/POST的消息体写入上传暂存目录
+};
+
+class response_builder;
+
+//流式响应的生成函数：每次调用往out追加下一段内容(不宜超过几十KB)，返回false表示内容已经全部生成
+//state在请求开始时为0，由函数自己记录进度；函数在工作线程中调用，不能阻塞
+typedef bool (*stream_producer)(const char *url, long *state, response_builder &out);
+
+struct route
+{
+    std::string_view path;  //精确路径或前缀
+    ROUTE_ACTION action;
+    const char *page;       //ROUTE_PAGE的目标页面，以'/'开头，相对doc_root
+    stream_producer stream; //ROUTE_STREAM的生成函数
+};
+
+class router
+{
+public:
+    static router *get_instance()
+    {
+        static router instance;
+        return &instance;
+    }
+
+    //注册额外的路由，只能在启动阶段、工作线程开始处理请求之前调用
+    //与已注册的运行时路由同名时覆盖，内置路由总是优先；prefix为true表示前缀匹配，多个前缀命中时取最长的
+    void add(const char *path, bool prefix, ROUTE_ACTION action, const char *page, stream_producer stream = NULL);
+
+    //依次查找内置路由、运行时精确路由和前缀路由，都不命中返回NULL(按静态文件处理)
+    const route *match(std::string_view url) const;
+
+private:
+    router() {}
+    ~router();
+
+    struct dynamic_route
+    {
+        std::string path;
+        std::string page;
+        route r;  //r.path/r.page指向上面两个字符串
+    };
+    const route *match_dynamic(std::string_view url) const;
+
+    //运行时路由，元素地址在注册后保持不变
+    std::vector<dynamic_route *> m_routes;
+    std::unordered_map<std::string_view, const route *> m_exact;
+    std::vector<const route *> m_prefix;  //按路径长度降序
+};
+
+#endif
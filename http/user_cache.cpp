@@ -0,0 +1,212 @@
+#include <mysql/mysql.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "user_cache.h"
+
+/*-------------------------------bloom_filter--------------------------------*/
+
+void bloom_filter::init(size_t bits, int hashes)
+{
+    size_t n = 64;
+    while (n < bits)
+        n <<= 1;
+    delete[] m_words;
+    m_words = new std::atomic<uint64_t>[n / 64]();
+    m_mask = n - 1;
+    m_hashes = hashes;
+}
+
+//一次FNV-1a得到两个哈希，第i个位置为 h1 + i * h2
+static inline void bloom_hash(std::string_view key, uint64_t *h1, uint64_t *h2)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (char c : key)
+    {
+        h ^= (unsigned char)c;
+        h *= 1099511628211ull;
+    }
+    *h1 = h;
+    *h2 = ((h >> 33) ^ (h * 0x9e3779b97f4a7c15ull)) | 1;
+}
+
+void bloom_filter::add(std::string_view key)
+{
+    if (!m_words)
+        return;
+    uint64_t h1, h2;
+    bloom_hash(key, &h1, &h2);
+    for (int i = 0; i < m_hashes; ++i)
+    {
+        size_t bit = (h1 + i * h2) & m_mask;
+        uint64_t mask = 1ull << (bit & 63);
+        //已经置位的不再写，减少缓存行失效
+        if (!(m_words[bit >> 6].load(std::memory_order_relaxed) & mask))
+            m_words[bit >> 6].fetch_or(mask, std::memory_order_relaxed);
+    }
+}
+
+bool bloom_filter::maybe_contains(std::string_view key) const
+{
+    uint64_t h1, h2;
+    bloom_hash(key, &h1, &h2);
+    for (int i = 0; i < m_hashes; ++i)
+    {
+        size_t bit = (h1 + i * h2) & m_mask;
+        if (!(m_words[bit >> 6].load(std::memory_order_relaxed) & (1ull << (bit & 63))))
+            return false;
+    }
+    return true;
+}
+
+/*--------------------------------user_cache---------------------------------*/
+
+void user_cache::init(connection_pool *pool, int close_log, size_t max_users, size_t max_negative, size_t bloom_bits,
+                      int negative_ttl)
+{
+    m_pool = pool;
+    m_close_log = close_log;
+    m_negative_ttl = negative_ttl;
+    m_users.set_capacity(max_users);
+    m_negative.set_capacity(max_negative);
+    m_writer.start(pool, close_log);
+    if (bloom_bits == 0)
+        return;
+    //每个用户名约占10位时误判率约1%
+    m_bloom.init(bloom_bits, 7);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, bloom_thread, this) != 0)
+    {
+        LOG_ERROR("user_cache: create bloom thread failed");
+        return;
+    }
+    pthread_detach(tid);
+}
+
+void *user_cache::bloom_thread(void *arg)
+{
+    ((user_cache *)arg)->load_bloom();
+    return NULL;
+}
+
+//逐行读取用户名，结果集不整体缓存在客户端
+void user_cache::load_bloom()
+{
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, m_pool);
+    if (!mysql)
+    {
+        LOG_ERROR("user_cache: no connection for bloom filter");
+        return;
+    }
+    if (mysql_query(mysql, "SELECT username FROM user"))
+    {
+        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+        return;
+    }
+    MYSQL_RES *result = mysql_use_result(mysql);
+    if (!result)
+    {
+        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+        return;
+    }
+    long rows = 0;
+    while (MYSQL_ROW row = mysql_fetch_row(result))
+    {
+        unsigned long *lengths = mysql_fetch_lengths(result);
+        if (row[0])
+            m_bloom.add(std::string_view(row[0], lengths[0]));
+        ++rows;
+    }
+    mysql_free_result(result);
+    m_bloom_ready.store(true, std::memory_order_release);
+    LOG_INFO("user_cache: bloom filter loaded, %ld users", rows);
+}
+
+static int64_t now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+bool user_cache::negative_hit(std::string_view name)
+{
+    int64_t expire;
+    size_t len;
+    if (!m_negative.get(name, (char *)&expire, sizeof(expire), &len))
+        return false;
+    if (len == sizeof(expire) && now_sec() < expire)
+        return true;
+    m_negative.erase(name);
+    return false;
+}
+
+USER_LOOKUP user_cache::check(std::string_view name, std::string_view passwd, bool *used_db)
+{
+    USER_LOOKUP ret = m_users.lookup(name, passwd);
+    if (ret != USER_ABSENT)
+        return ret;
+    if (bloom_ready() && !m_bloom.maybe_contains(name))
+        return USER_ABSENT;
+    if (negative_hit(name))
+        return USER_ABSENT;
+
+    uint64_t seq = m_register_seq.load(std::memory_order_acquire);
+    char db_passwd[user_store::MAX_FIELD_LEN];
+    size_t len = 0;
+    int found;
+    {
+        MYSQL *mysql = NULL;
+        connectionRAII mysqlcon(&mysql, m_pool);
+        if (!mysql)
+            return USER_ABSENT;
+        m_db_lookups.fetch_add(1, std::memory_order_relaxed);
+        if (used_db)
+            *used_db = true;
+        found = sql_select_passwd(mysql, name, db_passwd, sizeof(db_passwd), &len);
+    }
+    if (found < 0)
+        return USER_ABSENT;
+    if (found == 0)
+    {
+        if (m_register_seq.load(std::memory_order_acquire) == seq)
+        {
+            int64_t expire = now_sec() + m_negative_ttl;
+            m_negative.insert(name, std::string_view((const char *)&expire, sizeof(expire)));
+        }
+        return USER_ABSENT;
+    }
+    std::string_view stored(db_passwd, len);
+    m_users.insert(name, stored);
+    return stored == passwd ? USER_OK : USER_WRONG_PASSWD;
+}
+
+bool user_cache::add_user(std::string_view name, std::string_view passwd, bool *used_db)
+{
+    if (name.size() > user_store::MAX_FIELD_LEN || passwd.size() > user_store::MAX_FIELD_LEN)
+        return false;
+    //先检测是否有重名的
+    if (check(name, passwd, used_db) != USER_ABSENT)
+        return false;
+
+    //在正向缓存中占住这个名字，同名的并发注册只有一个能继续；写库失败再撤销
+    if (!m_users.insert(name, passwd))
+        return false;
+    m_bloom.add(name);
+    m_register_seq.fetch_add(1, std::memory_order_acq_rel);
+
+    //交给写库线程，和其他注册合并提交；重名(ER_DUP_ENTRY)或写库失败时撤销占位
+    if (used_db)
+        *used_db = true;
+    if (!m_writer.write(name, passwd))
+    {
+        m_users.erase(name);
+        return false;
+    }
+    m_register_seq.fetch_add(1, std::memory_order_acq_rel);
+    m_negative.erase(name);
+    return true;
+}
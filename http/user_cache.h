@@ -0,0 +1,86 @@
+//登录/注册使用的用户缓存，启动时不再把整张user表读进内存，内存有固定上限
+//查找顺序：
+//1.正向缓存(user_store，CLOCK淘汰)：命中则直接比较密码
+//2.布隆过滤器：记录数据库中所有用户名，由后台线程在启动后流式加载，加载完成前不参与判断；判定不存在则直接返回
+//3.反向缓存：最近查库确认不存在的用户名，超过negative_ttl秒后失效，重新查库
+//三级都无法确定时才查询数据库，结果回填正向或反向缓存
+#ifndef USER_CACHE_H
+#define USER_CACHE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string_view>
+#include "../CGImysql/sql_connection_pool.h"
+#include "user_store.h"
+#include "user_writer.h"
+
+//只增不删的布隆过滤器，置位和查询都不加锁
+class bloom_filter
+{
+public:
+    bloom_filter() : m_words(NULL), m_mask(0), m_hashes(0) {}
+    ~bloom_filter() { delete[] m_words; }
+
+    //bits向上取整为2的幂
+    void init(size_t bits, int hashes);
+    void add(std::string_view key);
+    //false表示一定不存在
+    bool maybe_contains(std::string_view key) const;
+
+private:
+    std::atomic<uint64_t> *m_words;
+    size_t m_mask;  //位数-1
+    int m_hashes;
+};
+
+class user_cache
+{
+public:
+    static user_cache *get_instance()
+    {
+        static user_cache instance;
+        return &instance;
+    }
+
+    //max_users/max_negative：正向/反向缓存的条目上限；bloom_bits：布隆过滤器的位数
+    //bloom_bits为0时不使用布隆过滤器：布隆过滤器看不到其他进程写入的用户，多个实例共用一张user表时应设为0
+    //negative_ttl：反向缓存条目的有效秒数
+    //只启动加载布隆过滤器的后台线程，立即返回
+    void init(connection_pool *pool, int close_log, size_t max_users = 65536, size_t max_negative = 8192,
+              size_t bloom_bits = 1 << 24, int negative_ttl = 60);
+
+    //登录校验，缓存无法确定时从连接池借一个连接查库，查完立即归还；查过库时*used_db置为true
+    USER_LOOKUP check(std::string_view name, std::string_view passwd, bool *used_db = NULL);
+    //注册：先写入正向缓存占住用户名，再由写库线程批量写入数据库，阻塞到写库完成
+    //用户名已存在或写库失败返回false
+    bool add_user(std::string_view name, std::string_view passwd, bool *used_db = NULL);
+
+    bool bloom_ready() const { return m_bloom_ready.load(std::memory_order_acquire); }
+    //查库次数，用来观察缓存效果
+    uint64_t db_lookups() const { return m_db_lookups.load(std::memory_order_relaxed); }
+    const user_writer &writer() const { return m_writer; }
+
+private:
+    user_cache() : m_pool(NULL), m_close_log(1), m_negative_ttl(60), m_bloom_ready(false), m_register_seq(0),
+                   m_db_lookups(0) {}
+
+    static void *bloom_thread(void *arg);
+    void load_bloom();
+    //反向缓存中有未过期的条目；过期的条目顺便删除
+    bool negative_hit(std::string_view name);
+
+    connection_pool *m_pool;
+    int m_close_log;
+    int m_negative_ttl;
+    user_store m_users;
+    user_store m_negative;  //值是条目的过期时间(单调时钟的秒数)
+    bloom_filter m_bloom;
+    user_writer m_writer;
+    std::atomic<bool> m_bloom_ready;
+    //注册计数：查库确认不存在到写反向缓存之间若有注册发生，就不写反向缓存，避免把刚注册的用户记成不存在
+    //占位和写库提交后各加一次，查库发生在提交之前、写反向缓存发生在提交之后的也能发现
+    std::atomic<uint64_t> m_register_seq;
+    std::atomic<uint64_t> m_db_lookups;
+};
+
+#endif
@@ -0,0 +1,316 @@
+#include <string.h>
+#include "user_store.h"
+
+static inline uint64_t make_meta(uint32_t tag, size_t name_len, size_t passwd_len, int state)
+{
+    return (uint64_t)tag << 32 | passwd_len << 16 | name_len << 8 | (uint64_t)state;
+}
+static inline int meta_state(uint64_t meta) { return meta & 0xff; }
+static inline size_t meta_name_len(uint64_t meta) { return (meta >> 8) & 0xff; }
+static inline size_t meta_passwd_len(uint64_t meta) { return (meta >> 16) & 0xff; }
+static inline uint32_t meta_tag(uint64_t meta) { return meta >> 32; }
+
+static const size_t INITIAL_SLOTS = 16;
+
+user_store::user_store() : m_shard_max((size_t)-1), m_size(0), m_bytes(0)
+{
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        m_shards[i].tab.store(new_table(INITIAL_SLOTS), std::memory_order_relaxed);
+        m_shards[i].live = 0;
+        m_shards[i].hand = 0;
+    }
+}
+
+user_store::~user_store()
+{
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        free_table(m_shards[i].tab.load(std::memory_order_relaxed));
+        for (size_t j = 0; j < m_shards[i].retired.size(); ++j)
+            free_table(m_shards[i].retired[j]);
+    }
+}
+
+void user_store::set_capacity(size_t max_users)
+{
+    m_shard_max = max_users ? (max_users + SHARDS - 1) / SHARDS : (size_t)-1;
+}
+
+//FNV-1a：高6位选分片，低32位作为槽位里的tag并决定初始槽位
+uint64_t user_store::hash(std::string_view name)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (char c : name)
+    {
+        h ^= (unsigned char)c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+user_store::table *user_store::new_table(size_t cap)
+{
+    table *t = new table;
+    t->mask = cap - 1;
+    t->slots = new slot[cap]();
+    m_bytes.fetch_add(cap * sizeof(slot), std::memory_order_relaxed);
+    return t;
+}
+
+void user_store::free_table(table *t)
+{
+    delete[] t->slots;
+    delete t;
+}
+
+//持有分片锁时调用：序号先变成奇数，写完再变回偶数
+void user_store::write_words(slot &s, uint64_t meta, const uint64_t *w)
+{
+    uint32_t seq = s.seq.load(std::memory_order_relaxed);
+    s.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.meta.store(meta, std::memory_order_relaxed);
+    for (int i = 0; i < 2 * FIELD_WORDS; ++i)
+        s.words[i].store(w[i], std::memory_order_relaxed);
+    s.seq.store(seq + 2, std::memory_order_release);
+}
+
+void user_store::move_slot(slot &dst, slot &src)
+{
+    uint64_t w[2 * FIELD_WORDS];
+    for (int i = 0; i < 2 * FIELD_WORDS; ++i)
+        w[i] = src.words[i].load(std::memory_order_relaxed);
+    dst.ref.store(src.ref.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    write_words(dst, src.meta.load(std::memory_order_relaxed), w);
+}
+
+//持有分片锁时调用，槽位不会被并发改写
+bool user_store::name_equals(const slot &s, std::string_view name)
+{
+    char buf[MAX_FIELD_LEN];
+    for (size_t j = 0; j * 8 < name.size(); ++j)
+    {
+        uint64_t w = s.words[j].load(std::memory_order_relaxed);
+        memcpy(buf + j * 8, &w, 8);
+    }
+    return memcmp(buf, name.data(), name.size()) == 0;
+}
+
+bool user_store::find(std::string_view name, snapshot *out) const
+{
+    if (name.empty() || name.size() > MAX_FIELD_LEN)
+        return false;
+    uint64_t h = hash(name);
+    const shard &sh = m_shards[h >> 58];
+    const table *t = sh.tab.load(std::memory_order_acquire);
+    uint32_t tag = h;
+
+    for (size_t i = tag & t->mask, n = 0; n <= t->mask; i = (i + 1) & t->mask, ++n)
+    {
+        slot &s = t->slots[i];
+        uint64_t meta;
+        bool candidate;
+        while (1)
+        {
+            uint32_t seq = s.seq.load(std::memory_order_acquire);
+            if (seq & 1)
+                continue;
+            meta = s.meta.load(std::memory_order_relaxed);
+            candidate = meta_state(meta) == SLOT_USED && meta_tag(meta) == tag && meta_name_len(meta) == name.size();
+            //tag和长度都相同时才拷贝内容，其他槽位只读一个meta
+            if (candidate)
+            {
+                for (int j = 0; j < 2 * FIELD_WORDS; ++j)
+                    out->words[j] = s.words[j].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.seq.load(std::memory_order_relaxed) == seq)
+                break;
+        }
+        if (meta_state(meta) == SLOT_EMPTY)
+            return false;
+        if (candidate && memcmp(out->words, name.data(), name.size()) == 0)
+        {
+            //访问位已经置上时不再写，避免热门用户的槽位在各核之间来回失效
+            if (!s.ref.load(std::memory_order_relaxed))
+                s.ref.store(1, std::memory_order_relaxed);
+            out->meta = meta;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool user_store::contains(std::string_view name) const
+{
+    snapshot s;
+    return find(name, &s);
+}
+
+bool user_store::get(std::string_view name, char *passwd, size_t cap, size_t *len) const
+{
+    snapshot s;
+    if (!find(name, &s))
+        return false;
+    *len = meta_passwd_len(s.meta);
+    memcpy(passwd, s.words + FIELD_WORDS, *len < cap ? *len : cap);
+    return true;
+}
+
+USER_LOOKUP user_store::lookup(std::string_view name, std::string_view passwd) const
+{
+    snapshot s;
+    if (!find(name, &s))
+        return USER_ABSENT;
+    if (meta_passwd_len(s.meta) == passwd.size() &&
+        (passwd.empty() || memcmp(s.words + FIELD_WORDS, passwd.data(), passwd.size()) == 0))
+        return USER_OK;
+    return USER_WRONG_PASSWD;
+}
+
+//换一张两倍大的表，旧表不释放
+void user_store::grow(shard &sh)
+{
+    table *old = sh.tab.load(std::memory_order_relaxed);
+    table *t = new_table((old->mask + 1) * 2);
+
+    for (size_t i = 0; i <= old->mask; ++i)
+    {
+        slot &s = old->slots[i];
+        uint64_t meta = s.meta.load(std::memory_order_relaxed);
+        if (meta_state(meta) != SLOT_USED)
+            continue;
+        size_t k = meta_tag(meta) & t->mask;
+        while (meta_state(t->slots[k].meta.load(std::memory_order_relaxed)) != SLOT_EMPTY)
+            k = (k + 1) & t->mask;
+        move_slot(t->slots[k], s);
+    }
+
+    sh.tab.store(t, std::memory_order_release);
+    sh.retired.push_back(old);
+}
+
+//清空槽位i，并把探测链上后面能前移的条目依次前移，表中始终没有删除标记
+void user_store::remove_at(shard &sh, size_t i)
+{
+    table *t = sh.tab.load(std::memory_order_relaxed);
+    size_t j = i;
+    while (1)
+    {
+        j = (j + 1) & t->mask;
+        uint64_t meta = t->slots[j].meta.load(std::memory_order_relaxed);
+        if (meta_state(meta) == SLOT_EMPTY)
+            break;
+        //初始槽位不在(i, j]之间的条目可以移到i
+        size_t home = meta_tag(meta) & t->mask;
+        if (((j - home) & t->mask) >= ((j - i) & t->mask))
+        {
+            move_slot(t->slots[i], t->slots[j]);
+            i = j;
+        }
+    }
+    static const uint64_t zero[2 * FIELD_WORDS] = {0};
+    t->slots[i].ref.store(0, std::memory_order_relaxed);
+    write_words(t->slots[i], 0, zero);
+    --sh.live;
+    m_size.fetch_sub(1, std::memory_order_relaxed);
+}
+
+//CLOCK：跳过访问位为1的条目并清除访问位，淘汰第一个访问位为0的条目
+void user_store::evict(shard &sh)
+{
+    table *t = sh.tab.load(std::memory_order_relaxed);
+    while (1)
+    {
+        size_t i = sh.hand & t->mask;
+        sh.hand = i + 1;
+        slot &s = t->slots[i];
+        if (meta_state(s.meta.load(std::memory_order_relaxed)) != SLOT_USED)
+            continue;
+        if (s.ref.load(std::memory_order_relaxed))
+        {
+            s.ref.store(0, std::memory_order_relaxed);
+            continue;
+        }
+        remove_at(sh, i);
+        return;
+    }
+}
+
+bool user_store::insert(std::string_view name, std::string_view passwd)
+{
+    if (name.empty() || name.size() > MAX_FIELD_LEN || passwd.size() > MAX_FIELD_LEN)
+        return false;
+    uint64_t h = hash(name);
+    shard &sh = m_shards[h >> 58];
+    uint32_t tag = h;
+
+    sh.lock.lock();
+    table *t = sh.tab.load(std::memory_order_relaxed);
+    size_t i = tag & t->mask;
+    while (1)
+    {
+        slot &s = t->slots[i];
+        uint64_t meta = s.meta.load(std::memory_order_relaxed);
+        if (meta_state(meta) == SLOT_EMPTY)
+            break;
+        if (meta_tag(meta) == tag && meta_name_len(meta) == name.size() && name_equals(s, name))
+        {
+            sh.lock.unlock();
+            return false;
+        }
+        i = (i + 1) & t->mask;
+    }
+
+    //淘汰或扩容会移动条目，之后重新找空槽
+    if (sh.live >= m_shard_max || (sh.live + 1) * 4 > (t->mask + 1) * 3)
+    {
+        if (sh.live >= m_shard_max)
+            evict(sh);
+        else
+            grow(sh);
+        t = sh.tab.load(std::memory_order_relaxed);
+        i = tag & t->mask;
+        while (meta_state(t->slots[i].meta.load(std::memory_order_relaxed)) != SLOT_EMPTY)
+            i = (i + 1) & t->mask;
+    }
+
+    uint64_t w[2 * FIELD_WORDS] = {0};
+    memcpy(w, name.data(), name.size());
+    if (!passwd.empty())
+        memcpy(w + FIELD_WORDS, passwd.data(), passwd.size());
+    t->slots[i].ref.store(0, std::memory_order_relaxed);
+    write_words(t->slots[i], make_meta(tag, name.size(), passwd.size(), SLOT_USED), w);
+    ++sh.live;
+    sh.lock.unlock();
+    m_size.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool user_store::erase(std::string_view name)
+{
+    if (name.empty() || name.size() > MAX_FIELD_LEN)
+        return false;
+    uint64_t h = hash(name);
+    shard &sh = m_shards[h >> 58];
+    uint32_t tag = h;
+
+    sh.lock.lock();
+    table *t = sh.tab.load(std::memory_order_relaxed);
+    for (size_t i = tag & t->mask;; i = (i + 1) & t->mask)
+    {
+        slot &s = t->slots[i];
+        uint64_t meta = s.meta.load(std::memory_order_relaxed);
+        if (meta_state(meta) == SLOT_EMPTY)
+            break;
+        if (meta_tag(meta) == tag && meta_name_len(meta) == name.size() && name_equals(s, name))
+        {
+            remove_at(sh, i);
+            sh.lock.unlock();
+            return true;
+        }
+    }
+    sh.lock.unlock();
+    return false;
+}
@@ -0,0 +1,113 @@
+//有容量上限的用户表：用户名 -> 密码
+//按用户名哈希分成SHARDS个分片，每个分片是一张线性探测的开放寻址表，槽位内联存放用户名和密码
+//读(登录)不加锁：每个槽位带一个序号(seqlock)，读者拷贝槽位内容后检查序号，期间被改写则重读
+//写(插入/删除)只锁所在分片；扩容时整表替换，旧表留到对象销毁，保证仍在读旧表的读者不会访问已释放的内存
+//达到容量后按CLOCK淘汰：查找命中时置访问位，淘汰指针扫过时清除访问位，跳过最近被访问过的条目
+//删除不留删除标记，而是把后面的条目前移；并发的读者因此可能短暂地查不到正在被移动的条目，
+//所以查找未命中只表示"不在表中或无法确定"，调用方需要有后备(如查库)
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string_view>
+#include <vector>
+#include "../lock/locker.h"
+
+enum USER_LOOKUP
+{
+    USER_ABSENT = 0,     //用户不存在(或无法确定)
+    USER_WRONG_PASSWD,   //用户存在，密码不一致
+    USER_OK
+};
+
+class user_store
+{
+public:
+    static const int SHARDS = 64;
+    static const int FIELD_WORDS = 13;
+    static const size_t MAX_FIELD_LEN = FIELD_WORDS * 8;  //用户名、密码各自的最大字节数
+
+    user_store();
+    ~user_store();
+
+    //最多保存的用户数，按分片平均分配；0表示不限。应在使用前设置
+    void set_capacity(size_t max_users);
+
+    //用户名不存在时插入并返回true，容量已满时先淘汰一个；已存在或字段超长返回false
+    bool insert(std::string_view name, std::string_view passwd);
+    //删除用户，不存在返回false
+    bool erase(std::string_view name);
+
+    //以下读操作不加锁
+    USER_LOOKUP lookup(std::string_view name, std::string_view passwd) const;
+    bool contains(std::string_view name) const;
+    //取出密码，最多拷贝cap字节，*len为密码实际长度；不存在返回false
+    bool get(std::string_view name, char *passwd, size_t cap, size_t *len) const;
+    bool check(std::string_view name, std::string_view passwd) const { return lookup(name, passwd) == USER_OK; }
+
+    size_t size() const { return m_size.load(std::memory_order_relaxed); }
+    //槽位表(含扩容替换下来的旧表)占用的字节数
+    size_t memory_bytes() const { return m_bytes.load(std::memory_order_relaxed); }
+
+private:
+    user_store(const user_store &);
+    user_store &operator=(const user_store &);
+
+    enum SLOT_STATE
+    {
+        SLOT_EMPTY = 0,
+        SLOT_USED
+    };
+
+    //meta = tag(哈希低32位，也用来算初始槽位) | passwd_len << 16 | name_len << 8 | state
+    struct slot
+    {
+        std::atomic<uint32_t> seq;  //奇数表示正在写
+        std::atomic<uint8_t> ref;   //CLOCK访问位
+        std::atomic<uint64_t> meta;
+        std::atomic<uint64_t> words[2 * FIELD_WORDS];  //用户名在前，密码在后
+    };
+
+    struct table
+    {
+        size_t mask;
+        slot *slots;
+    };
+
+    struct alignas(64) shard
+    {
+        locker lock;
+        std::atomic<table *> tab;
+        size_t live;                  //已用槽位数
+        size_t hand;                  //CLOCK淘汰指针
+        std::vector<table *> retired; //扩容替换下来的旧表
+    };
+
+    //读者拷贝出的槽位内容
+    struct snapshot
+    {
+        uint64_t meta;
+        uint64_t words[2 * FIELD_WORDS];
+    };
+
+    static uint64_t hash(std::string_view name);
+    table *new_table(size_t cap);
+    static void free_table(table *t);
+    static bool name_equals(const slot &s, std::string_view name);
+    static void write_words(slot &s, uint64_t meta, const uint64_t *w);
+    static void move_slot(slot &dst, slot &src);
+    //找到name所在的槽位并拷贝，未找到返回false
+    bool find(std::string_view name, snapshot *out) const;
+    void grow(shard &sh);
+    void remove_at(shard &sh, size_t i);
+    void evict(shard &sh);
+
+    shard m_shards[SHARDS];
+    size_t m_shard_max;   //每个分片最多保存的用户数
+    std::atomic<size_t> m_size;
+    std::atomic<size_t> m_bytes;
+};
+
+#endif
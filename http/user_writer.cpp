@@ -0,0 +1,171 @@
+#include <mysql/mysql.h>
+#include <mysql/mysqld_error.h>
+#include <pthread.h>
+#include <time.h>
+#include "user_writer.h"
+
+user_writer::user_writer()
+    : m_pool(NULL), m_close_log(1), m_batch_size(64), m_batch_wait_ms(2),
+      m_head(NULL), m_tail(&m_head), m_pending(-1), m_stop(false), m_batches(0), m_rows(0)
+{
+}
+
+//等队列中已有的注册写完再退出；条件变量上还有线程等待时不能销毁它
+user_writer::~user_writer()
+{
+    m_lock.lock();
+    bool started = m_pending >= 0;
+    m_stop = true;
+    m_cond.signal();
+    m_lock.unlock();
+    if (started)
+        pthread_join(m_tid, NULL);
+}
+
+bool user_writer::start(connection_pool *pool, int close_log, int batch_size, int batch_wait_ms)
+{
+    m_pool = pool;
+    m_close_log = close_log;
+    m_batch_size = batch_size > 0 ? batch_size : 1;
+    m_batch_wait_ms = batch_wait_ms >= 0 ? batch_wait_ms : 0;
+
+    if (pthread_create(&m_tid, NULL, worker, this) != 0)
+    {
+        LOG_ERROR("user_writer: create thread failed");
+        return false;
+    }
+    m_lock.lock();
+    m_pending = 0;
+    m_lock.unlock();
+    return true;
+}
+
+bool user_writer::write(std::string_view name, std::string_view passwd)
+{
+    request r;
+    r.name = name;
+    r.passwd = passwd;
+    r.ok = false;
+    r.next = NULL;
+
+    m_lock.lock();
+    //写库线程没有启动
+    if (m_pending < 0)
+    {
+        m_lock.unlock();
+        return false;
+    }
+    *m_tail = &r;
+    m_tail = &r.next;
+    ++m_pending;
+    //队列由空变非空，或者攒够一批时唤醒写库线程
+    if (m_pending == 1 || m_pending == m_batch_size)
+        m_cond.signal();
+    m_lock.unlock();
+
+    r.done.wait();
+    return r.ok;
+}
+
+void *user_writer::worker(void *arg)
+{
+    ((user_writer *)arg)->run();
+    return NULL;
+}
+
+void user_writer::run()
+{
+    while (true)
+    {
+        m_lock.lock();
+        while (!m_head && !m_stop)
+            m_cond.wait(m_lock.get());
+        if (!m_head)
+        {
+            m_lock.unlock();
+            break;
+        }
+
+        //不满一批时最多再等batch_wait_ms，让并发的注册合并到同一次提交
+        if (m_pending < m_batch_size && m_batch_wait_ms > 0 && !m_stop)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += m_batch_wait_ms * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            while (m_pending < m_batch_size)
+            {
+                if (!m_cond.timewait(m_lock.get(), deadline))
+                    break;
+            }
+        }
+
+        //取出至多一批
+        request *batch = m_head;
+        request **last = &m_head;
+        int n = 0;
+        while (*last && n < m_batch_size)
+        {
+            last = &(*last)->next;
+            ++n;
+        }
+        m_head = *last;
+        *last = NULL;
+        if (!m_head)
+            m_tail = &m_head;
+        m_pending -= n;
+        m_lock.unlock();
+
+        //每批借一个连接，提交后马上归还：空闲时不占连接池的名额，后台线程也能回收它；
+        //借不到(最多等连接池的借用超时)时整批失败，连接断开由ReleaseConnection关闭
+        MYSQL *mysql = m_pool->GetConnection();
+        if (!mysql)
+            LOG_ERROR("user_writer: no database connection");
+        flush(mysql, batch, n);
+        m_pool->ReleaseConnection(mysql);
+    }
+}
+
+//一批在同一个事务里逐行执行预处理好的INSERT，只在COMMIT时落盘一次；
+//重名的行单独失败(InnoDB只回滚出错的那条语句)，不影响同批的其他行；
+//其他错误(如连接断开)时事务状态不可信，整批回滚并全部失败
+void user_writer::flush(MYSQL *mysql, request *batch, int n)
+{
+    if (mysql && mysql_query(mysql, "START TRANSACTION"))
+    {
+        LOG_ERROR("START TRANSACTION error:%s\n", mysql_error(mysql));
+    }
+    else if (mysql)
+    {
+        bool broken = false;
+        for (request *r = batch; r && !broken; r = r->next)
+        {
+            unsigned err = sql_insert_user(mysql, r->name, r->passwd);
+            r->ok = err == 0;
+            if (err && err != ER_DUP_ENTRY)
+            {
+                LOG_ERROR("INSERT error:%u\n", err);
+                broken = true;
+            }
+        }
+        if (broken || mysql_query(mysql, "COMMIT"))
+        {
+            if (!broken)
+                LOG_ERROR("COMMIT error:%s\n", mysql_error(mysql));
+            mysql_query(mysql, "ROLLBACK");
+            for (request *r = batch; r; r = r->next)
+                r->ok = false;
+        }
+    }
+    m_batches.fetch_add(1, std::memory_order_relaxed);
+    m_rows.fetch_add(n, std::memory_order_relaxed);
+
+    //post之后请求所在的栈帧随时可能失效，先取next
+    for (request *r = batch; r;)
+    {
+        request *next = r->next;
+        r->done.post();
+        r = next;
+    }
+}
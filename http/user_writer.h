@@ -0,0 +1,60 @@
+//注册写库的后台线程：工作线程把新用户挂进队列后等待自己的完成信号，
+//写库线程攒够batch_size条或等满batch_wait_ms毫秒后，在一个事务里写入整批，一次提交
+#ifndef USER_WRITER_H
+#define USER_WRITER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string_view>
+#include "../lock/locker.h"
+#include "../CGImysql/sql_connection_pool.h"
+
+class user_writer
+{
+public:
+    user_writer();
+    ~user_writer();
+
+    //启动写库线程
+    bool start(connection_pool *pool, int close_log, int batch_size = 64, int batch_wait_ms = 2);
+
+    //排队写入一个用户，阻塞到所在批次提交完成；重名或写库失败返回false
+    bool write(std::string_view name, std::string_view passwd);
+
+    //已处理的批次数和行数，用来观察攒批效果
+    uint64_t batches() const { return m_batches.load(std::memory_order_relaxed); }
+    uint64_t rows() const { return m_rows.load(std::memory_order_relaxed); }
+
+private:
+    //放在调用write()的线程栈上，完成后由写库线程post
+    struct request
+    {
+        std::string_view name;
+        std::string_view passwd;
+        bool ok;
+        sem done;
+        request *next;
+    };
+
+    static void *worker(void *arg);
+    void run();
+    void flush(MYSQL *mysql, request *batch, int n);
+
+    connection_pool *m_pool;
+    int m_close_log;
+    int m_batch_size;
+    int m_batch_wait_ms;
+
+    locker m_lock;
+    cond m_cond;
+    request *m_head;
+    request **m_tail;
+    int m_pending;  //-1表示写库线程没有启动
+    bool m_stop;
+    pthread_t m_tid;
+
+    std::atomic<uint64_t> m_batches;
+    std::atomic<uint64_t> m_rows;
+};
+
+#endif
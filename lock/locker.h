@@ -137,6 +137,34 @@ public:
     }
 };
 
+//实现读写锁包装类：读多写少的场合，多个读者可以同时持有
+class rwlocker{
+private:
+    pthread_rwlock_t m_rwlock;
+public:
+    rwlocker(){
+        if(pthread_rwlock_init(&m_rwlock,NULL)!=0){
+            throw std::exception();
+        }
+    }
+
+    ~rwlocker(){
+        pthread_rwlock_destroy(&m_rwlock);
+    }
+
+    bool rdlock(){
+        return pthread_rwlock_rdlock(&m_rwlock)==0;
+    }
+
+    bool wrlock(){
+        return pthread_rwlock_wrlock(&m_rwlock)==0;
+    }
+
+    bool unlock(){
+        return pthread_rwlock_unlock(&m_rwlock)==0;
+    }
+};
+
 //实现条件变量
 class cond{
 private:
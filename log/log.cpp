@@ -149,7 +149,6 @@ void Log::write_log(int level, const char *format, ...)
     //将传入的format参数赋值给valst，便于格式化输出
     va_start(valst, format);//valst包含了与格式字符串format对应的参数
     
-    string log_str;
     m_mutex.lock();
 
     //写入格式化：时间、内容
@@ -162,18 +161,17 @@ void Log::write_log(int level, const char *format, ...)
     int m = vsnprintf(m_buf + n, m_log_buf_size - n - 1, format, valst);//它会按照 format 指定的格式，将 valst 中的参数格式化为字符串。
     m_buf[n + m] = '\n';
     m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
-
-    m_mutex.unlock();
 
+    //同步写入直接从m_buf输出，不再先拷贝成临时string；只有进入异步队列时才需要一份拷贝
     if (m_is_async && !m_log_queue->full())
     {
+        string log_str(m_buf, n + m + 1);
+        m_mutex.unlock();
         m_log_queue->push(log_str);
     }
     else
     {
-        m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);//同步用fputs写日志
+        fputs(m_buf, m_fp);//同步用fputs写日志
         m_mutex.unlock();
     }
 
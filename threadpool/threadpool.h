@@ -29,7 +29,7 @@ private:
     sem m_queuestat;//是否有任务需要处理 -> 从请求队列读
     int m_actor_model;          //模型切换
 
-    connection_pool * m_connPool;//数据库连接池  数据库连接的内容是为了配合工作线程的读事件，为了本项目而引入的
+    connection_pool * m_connPool;//数据库连接池  工作线程不再为每个请求预取连接，需要数据库的处理函数自己按需借用
 
 public:
     threadpool(int actor_model, connection_pool *connPool, int thread_number = 8, int max_request = 10000);
@@ -154,8 +154,7 @@ void threadpool<T>::run()
                 if (request->read_once())
                 {
                     request->improv = 1;
-                    connectionRAII mysqlcon(&request->mysql, m_connPool); // 获取数据库连接
-                    request->process(); // 处理请求
+                    request->process(); // 处理请求，需要数据库的处理函数自己按需从连接池取连接
                 }
                 else
                 {
@@ -178,8 +177,7 @@ void threadpool<T>::run()
         }
         else // Proactor模式
         {
-            connectionRAII mysqlcon(&request->mysql, m_connPool); // 获取数据库连接
-            request->process(); // 处理请求
+            request->process(); // 处理请求，需要数据库的处理函数自己按需从连接池取连接
         }
     }
 }
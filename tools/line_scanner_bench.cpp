@@ -0,0 +1,365 @@
+//请求头解析的基准：用一组浏览器实际发出的请求头(长User-Agent、Cookie、sec-ch-ua、Referer等，行长参差不齐)，
+//对比find_crlf()背后逐字节、SSE2、AVX2三种实现。每种实现测两项：
+//  scan      只按parse_line()的方式逐行找行结束符，单独衡量行扫描本身
+//  http_conn 把整组请求以流水线方式写进socketpair，由真实的http_conn走read_once/process_read/write完整处理，
+//            响应的静态文件放在临时目录里，全部命中文件缓存
+//编译：g++ -std=c++17 -O2 -pthread -o line_scanner_bench tools/line_scanner_bench.cpp http/*.cpp CGImysql/*.cpp log/log.cpp timer/lst_timer.cpp -lmysqlclient -lz
+//用法：./line_scanner_bench [轮数=20000] [请求文件]
+//      请求文件是抓包得到的原始请求流(只含不带消息体的请求)，给出时替换内置的请求集，找不到的路径按404处理
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "../http/http_conn.h"
+
+static long g_rounds = 20000;
+
+//浏览器打开站点并加载资源的一组请求：首页导航、样式/脚本/图片子资源、带校验头的重新验证、跳转到其他页面
+static const char *g_requests[] = {
+    "GET / HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8,en-US;q=0.7\r\n"
+    "Cookie: _ga=GA1.1.1739216524.1712045588; _ga_7Q9ZK3XJ1B=GS1.1.1714380052.12.1.1714380417.0.0.0; "
+    "Hm_lvt_2b0f8c4c5b6d=1713934271,1714124410,1714380052; sid=s%3AqN8kq1L3tZx0mYb7R2f5hJ9uVwE4cT6a.Zl0X2nH8q3Kp7vR1sY5dT9wB4mC6eF8gJ0kL2oP4rU; "
+    "theme=dark; lang=zh-CN\r\n"
+    "\r\n",
+
+    "GET /static/css/site.css HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Accept: text/css,*/*;q=0.1\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: style\r\n"
+    "Referer: http://www.example.com/\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8,en-US;q=0.7\r\n"
+    "Cookie: _ga=GA1.1.1739216524.1712045588; _ga_7Q9ZK3XJ1B=GS1.1.1714380052.12.1.1714380417.0.0.0; "
+    "Hm_lvt_2b0f8c4c5b6d=1713934271,1714124410,1714380052; sid=s%3AqN8kq1L3tZx0mYb7R2f5hJ9uVwE4cT6a.Zl0X2nH8q3Kp7vR1sY5dT9wB4mC6eF8gJ0kL2oP4rU; "
+    "theme=dark; lang=zh-CN\r\n"
+    "\r\n",
+
+    "GET /static/js/app.js HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10.15; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+    "Accept: */*\r\n"
+    "Accept-Language: zh-CN,zh;q=0.8,zh-TW;q=0.7,zh-HK;q=0.5,en-US;q=0.3,en;q=0.2\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: http://www.example.com/\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: _ga=GA1.1.902211745.1713311870; sid=s%3A7hGk2Wq9rT1yU5iO3pA8sD4fJ6lZ0xC.c2VydmVyLXNpZ25lZC10b2tlbi1mb3ItYmVuY2g; lang=zh-CN\r\n"
+    "Sec-Fetch-Dest: script\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "\r\n",
+
+    "GET /static/img/logo.png HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Referer: http://www.example.com/\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8,en-US;q=0.7\r\n"
+    "Cookie: _ga=GA1.1.1739216524.1712045588; _ga_7Q9ZK3XJ1B=GS1.1.1714380052.12.1.1714380417.0.0.0; "
+    "Hm_lvt_2b0f8c4c5b6d=1713934271,1714124410,1714380052; sid=s%3AqN8kq1L3tZx0mYb7R2f5hJ9uVwE4cT6a.Zl0X2nH8q3Kp7vR1sY5dT9wB4mC6eF8gJ0kL2oP4rU; "
+    "theme=dark; lang=zh-CN\r\n"
+    "If-None-Match: \"0-0\"\r\n"
+    "If-Modified-Since: Tue, 02 Apr 2024 08:13:07 GMT\r\n"
+    "\r\n",
+
+    "GET /5 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Cookie: sid=s%3Aw3Lr8Pz1Xk6Nq0Tb4Vc9Ys2Hm5Jd7Fg.QmVuY2htYXJrLXNlc3Npb24tc2lnbmF0dXJl; lang=zh-CN\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Language: zh-CN,zh-Hans;q=0.9\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "User-Agent: Mozilla/5.0 (iPhone; CPU iPhone OS 17_4_1 like Mac OS X) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.4.1 Mobile/15E148 Safari/604.1\r\n"
+    "Referer: http://www.example.com/\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+
+    "GET /favicon.ico HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/123.0.0.0 Safari/537.36 Edg/123.0.2420.97\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Referer: http://www.example.com/5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "\r\n",
+};
+
+//内置请求集用到的文件：相对文档根目录的路径和内容
+static const char *g_files[][2] = {
+    {"judge.html", "<!DOCTYPE html><html><head><title>judge</title></head><body>judge</body></html>\n"},
+    {"picture.html", "<!DOCTYPE html><html><head><title>picture</title></head><body>picture</body></html>\n"},
+    {"static/css/site.css", "body{margin:0;font-family:sans-serif}\n"},
+    {"static/js/app.js", "document.addEventListener('DOMContentLoaded',function(){});\n"},
+    {"static/img/logo.png", "PNG\n"},
+    {"favicon.ico", "ICO\n"},
+};
+
+struct impl
+{
+    const char *label;
+    FIND_CRLF_IMPL id;
+};
+
+static const impl g_impls[] = {
+    {"scalar", FIND_CRLF_SCALAR},
+    {"sse2", FIND_CRLF_SSE2},
+    {"avx2", FIND_CRLF_AVX2},
+    {"auto", FIND_CRLF_AUTO},
+};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//和parse_line()一样：找到'\r'后跳过"\r\n"，从下一行开头继续
+static long scan(const char *buf, size_t len)
+{
+    long lines = 0;
+    size_t i = 0;
+    while (i < len)
+    {
+        i += find_crlf(buf + i, len - i);
+        if (i >= len)
+            break;
+        i += buf[i] == '\r' && i + 1 < len && buf[i + 1] == '\n' ? 2 : 1;
+        ++lines;
+    }
+    return lines;
+}
+
+static long count(const std::string &s, const char *needle)
+{
+    long n = 0;
+    for (size_t pos = s.find(needle); pos != std::string::npos; pos = s.find(needle, pos + 1))
+        ++n;
+    return n;
+}
+
+//在临时目录下建出内置请求集用到的文件，返回目录
+static std::string make_root()
+{
+    char dir[] = "/tmp/line_scanner_bench.XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        exit(1);
+    }
+    std::string root = dir;
+    for (size_t i = 0; i < sizeof(g_files) / sizeof(g_files[0]); ++i)
+    {
+        std::string path = root + "/" + g_files[i][0];
+        for (size_t pos = path.find('/', root.size() + 1); pos != std::string::npos; pos = path.find('/', pos + 1))
+            mkdir(path.substr(0, pos).c_str(), 0755);
+        FILE *fp = fopen(path.c_str(), "wb");
+        if (!fp)
+        {
+            perror(path.c_str());
+            exit(1);
+        }
+        fputs(g_files[i][1], fp);
+        fclose(fp);
+    }
+    return root;
+}
+
+static void remove_root(const std::string &root)
+{
+    std::string cmd = "rm -rf '" + root + "'";
+    if (system(cmd.c_str()) != 0)
+        fprintf(stderr, "failed to remove %s\n", root.c_str());
+}
+
+//驱动一个http_conn：把整组请求写进socketpair，按epoll事件调用read_once/process/write，
+//直到收到expect字节的响应(expect为0时收到want个响应为止)，返回收到的响应
+static bool serve(http_conn &conn, int client, const std::string &reqs, size_t expect, long want, std::string *out)
+{
+    size_t sent = 0, received = 0;
+    char buf[65536];
+    while (expect ? received < expect : count(*out, "HTTP/1.1 ") < want)
+    {
+        if (sent < reqs.size())
+        {
+            ssize_t n = send(client, reqs.data() + sent, reqs.size() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0)
+                sent += n;
+        }
+
+        epoll_event ev;
+        int n = epoll_wait(http_conn::m_epollfd, &ev, 1, 1000);
+        if (n <= 0)
+        {
+            fprintf(stderr, "no progress after %zu response bytes\n", received);
+            return false;
+        }
+        if (ev.events & EPOLLIN)
+        {
+            if (!conn.read_once())
+                return false;
+            conn.process();
+        }
+        else if (ev.events & EPOLLOUT)
+        {
+            if (!conn.write())
+            {
+                fprintf(stderr, "connection closed by server\n");
+                return false;
+            }
+        }
+
+        ssize_t r;
+        while ((r = recv(client, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        {
+            received += r;
+            if (out)
+                out->append(buf, r);
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        g_rounds = atol(argv[1]);
+    if (g_rounds < 1)
+    {
+        fprintf(stderr, "usage: %s [rounds] [request_file]\n", argv[0]);
+        return 1;
+    }
+
+    std::string reqs;
+    if (argc > 2)
+    {
+        FILE *fp = fopen(argv[2], "rb");
+        if (!fp)
+        {
+            perror(argv[2]);
+            return 1;
+        }
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+            reqs.append(buf, n);
+        fclose(fp);
+    }
+    else
+    {
+        for (size_t i = 0; i < sizeof(g_requests) / sizeof(g_requests[0]); ++i)
+            reqs += g_requests[i];
+    }
+    long nreq = count(reqs, "\r\n\r\n");
+    if (nreq == 0)
+    {
+        fprintf(stderr, "no complete request found\n");
+        return 1;
+    }
+
+    std::string root = make_root();
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+        perror("socketpair");
+        return 1;
+    }
+    http_conn::m_epollfd = epoll_create(5);
+    http_conn *conn = new http_conn;
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    conn->init(sv[0], addr, (char *)root.c_str(), 0, 1, "", "", "");
+
+    //预热一轮：填满文件缓存，记下一轮响应的总字节数，并确认每个请求都得到了响应
+    std::string first;
+    if (!serve(*conn, sv[1], reqs, 0, nreq, &first))
+        return 1;
+    size_t expect = first.size();
+    long lines = scan(reqs.data(), reqs.size());
+    printf("%ld requests, %zu header bytes, %ld lines (%.1f bytes/line), %zu response bytes per round, rounds %ld\n",
+           nreq, reqs.size(), lines, (double)reqs.size() / lines, expect, g_rounds);
+    if (argc <= 2 && count(first, "HTTP/1.1 200") + count(first, "HTTP/1.1 304") != nreq)
+        fprintf(stderr, "warning: not every built-in request got 200/304:\n%s\n", first.c_str());
+
+    printf("%-8s %14s %14s %14s %12s\n", "impl", "scan ns/req", "scan GB/s", "http_conn req/s", "header MB/s");
+    for (size_t i = 0; i < sizeof(g_impls) / sizeof(g_impls[0]); ++i)
+    {
+        if (!find_crlf_use(g_impls[i].id))
+        {
+            printf("%-8s not supported on this CPU\n", g_impls[i].label);
+            continue;
+        }
+
+        //扫描的轮数放大，单轮只有几KB，太少时计时误差过大；两项都取3次中最快的一次，减少调度抖动的影响
+        long scan_rounds = g_rounds * 10;
+        double scan_sec = 0, sec = 0;
+        for (int t = 0; t < 3; ++t)
+        {
+            long scanned = 0;
+            double start = now();
+            for (long r = 0; r < scan_rounds; ++r)
+            {
+                scanned += scan(reqs.data(), reqs.size());
+                __asm__ __volatile__("" ::: "memory");
+            }
+            double elapsed = now() - start;
+            if (scanned != lines * scan_rounds)
+                printf("%-8s scan MISMATCH\n", g_impls[i].label);
+            if (t == 0 || elapsed < scan_sec)
+                scan_sec = elapsed;
+
+            start = now();
+            for (long r = 0; r < g_rounds; ++r)
+            {
+                if (!serve(*conn, sv[1], reqs, expect, nreq, NULL))
+                    return 1;
+            }
+            elapsed = now() - start;
+            if (t == 0 || elapsed < sec)
+                sec = elapsed;
+        }
+
+        printf("%-8s %14.1f %14.2f %14.0f %12.1f\n", g_impls[i].label,
+               scan_sec * 1e9 / (scan_rounds * nreq), reqs.size() * (double)scan_rounds / scan_sec / 1e9,
+               nreq * g_rounds / sec, reqs.size() * (double)g_rounds / sec / 1e6);
+    }
+
+    find_crlf_use(FIND_CRLF_AUTO);
+    close(sv[1]);
+    remove_root(root);
+    return 0;
+}
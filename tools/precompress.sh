@@ -0,0 +1,26 @@
+#!/bin/sh
+# 为网站根目录下的文本文件离线生成预压缩旁路文件 foo.html.gz / foo.html.br
+# http_conn会根据Accept-Encoding直接发送它们，运行时不再压缩
+# 用法：tools/precompress.sh <doc_root>
+# 旁路文件的修改时间与原文件相同；原文件更新后需重新运行，否则服务器认为旁路文件过期而发送原文件
+
+root=${1:?usage: $0 <doc_root>}
+has_brotli=0
+command -v brotli >/dev/null 2>&1 && has_brotli=1
+
+find "$root" -type f \( -name '*.html' -o -name '*.htm' -o -name '*.css' -o -name '*.js' \
+    -o -name '*.json' -o -name '*.svg' -o -name '*.txt' -o -name '*.xml' \) | while read -r f
+do
+    size=$(wc -c < "$f")
+
+    gzip -9 -k -n -f "$f"
+    touch -r "$f" "$f.gz"
+    # 压缩后没有变小的就不保留
+    [ "$(wc -c < "$f.gz")" -lt "$size" ] || rm -f "$f.gz"
+
+    if [ "$has_brotli" = 1 ]; then
+        brotli -q 11 -k -f "$f"
+        touch -r "$f" "$f.br"
+        [ "$(wc -c < "$f.br")" -lt "$size" ] || rm -f "$f.br"
+    fi
+done
@@ -0,0 +1,128 @@
+//read_buffer::read_fd的回归测试：新连接第一次就读到超过64KB的数据时，
+//两段iovec合计不能超过MAX_SIZE-1，否则升级块时超出上限返回ENOMEM，已读到的数据被丢弃
+//编译：g++ -std=c++17 -O2 -pthread -o read_buffer_test tools/read_buffer_test.cpp http/read_buffer.cpp
+//用法：./read_buffer_test，全部通过时返回0
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include "../http/read_buffer.h"
+
+static int g_failed = 0;
+
+#define CHECK(cond)                                                  \
+    do                                                               \
+    {                                                                \
+        if (!(cond))                                                 \
+        {                                                            \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed, errno=%d (%s)\n", \
+                    __FILE__, __LINE__, #cond, errno, strerror(errno)); \
+            ++g_failed;                                              \
+        }                                                            \
+    } while (0)
+
+static char pattern(size_t i)
+{
+    return 'a' + i % 26;
+}
+
+//建立一对socket，往写端塞入len字节(写端设为足够大的发送缓冲区)，返回读端
+static int make_pair(size_t len, int *writer)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+        perror("socketpair");
+        exit(1);
+    }
+    int sndbuf = (int)len * 2;
+    setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    char *data = (char *)malloc(len);
+    for (size_t i = 0; i < len; ++i)
+        data[i] = pattern(i);
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = write(fds[1], data + done, len - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    free(data);
+    *writer = fds[1];
+    return fds[0];
+}
+
+//读到缓冲区放满为止，检查每次都不失败、内容和结尾'\0'正确
+static void read_until_full(read_buffer &buf, int fd, size_t used)
+{
+    while (used < (size_t)read_buffer::MAX_SIZE - 1)
+    {
+        ssize_t n = buf.read_fd(fd, used);
+        if (n < 0 && errno == EAGAIN)
+            break;
+        CHECK(n > 0);
+        if (n <= 0)
+            return;
+        used += n;
+        CHECK(used <= (size_t)read_buffer::MAX_SIZE - 1);
+        CHECK(buf.capacity() > used);
+    }
+    CHECK(used == (size_t)read_buffer::MAX_SIZE - 1);
+    for (size_t i = 0; i < used; ++i)
+    {
+        if (buf.data()[i] != pattern(i))
+        {
+            CHECK(buf.data()[i] == pattern(i));
+            break;
+        }
+    }
+    CHECK(buf.data()[used] == '\0');
+}
+
+//还没有块的新连接，第一次readv就能读满
+static void test_first_read_over_max()
+{
+    int writer;
+    int fd = make_pair(200 * 1024, &writer);
+    read_buffer buf;
+    ssize_t n = buf.read_fd(fd, 0);
+    CHECK(n == read_buffer::MAX_SIZE - 1);
+    if (n > 0)
+        read_until_full(buf, fd, n);
+    close(fd);
+    close(writer);
+}
+
+//已经借到小块、里面有一部分数据时再读到超过上限的数据
+static void test_grow_from_small_block()
+{
+    int writer;
+    int fd = make_pair(200 * 1024, &writer);
+    read_buffer buf;
+    size_t used = 100;
+    CHECK(buf.reserve(0, used + 1));
+    CHECK(read(fd, buf.data(), used) == (ssize_t)used);
+    read_until_full(buf, fd, used);
+    close(fd);
+    close(writer);
+}
+
+int main()
+{
+    test_first_read_over_max();
+    test_grow_from_small_block();
+    if (g_failed)
+    {
+        fprintf(stderr, "%d check(s) failed\n", g_failed);
+        return 1;
+    }
+    printf("read_buffer_test passed\n");
+    return 0;
+}
@@ -0,0 +1,136 @@
+//user_cache反向缓存的回归测试，需要一个可用的MySQL，user表结构同服务器
+//1.查库确认不存在的用户名写入反向缓存后，别的进程(或写库线程提交晚于查库的注册)写入了这个用户：
+//  有效期内仍按不存在处理，过期后必须重新查库并能登录
+//2.注册与并发的登录查询交错时，注册返回成功之后立即登录必须成功
+//编译：g++ -std=c++17 -O2 -pthread -o user_cache_test tools/user_cache_test.cpp http/user_cache.cpp http/user_store.cpp http/user_writer.cpp CGImysql/*.cpp log/log.cpp -lmysqlclient
+//用法：./user_cache_test 数据库用户名 数据库密码 数据库名 [主机=localhost]，全部通过时返回0
+//      测试用户名带进程号，结束时删除
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <mysql/mysql.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include "../http/user_cache.h"
+#include "../CGImysql/sql_statement.h"
+
+static int g_failed = 0;
+
+#define CHECK(cond)                                                  \
+    do                                                               \
+    {                                                                \
+        if (!(cond))                                                 \
+        {                                                            \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n",             \
+                    __FILE__, __LINE__, #cond);                      \
+            ++g_failed;                                              \
+        }                                                            \
+    } while (0)
+
+static const int NEGATIVE_TTL = 1;
+static connection_pool *g_pool;
+static std::vector<std::string> g_names;
+
+static std::string test_name(const char *tag, int i)
+{
+    std::string name = "uct_" + std::to_string(getpid()) + "_" + tag + std::to_string(i);
+    g_names.push_back(name);
+    return name;
+}
+
+//绕过user_cache直接写库，相当于另一个服务器实例注册了这个用户
+static bool insert_direct(const std::string &name, const char *passwd)
+{
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, g_pool);
+    return mysql && sql_insert_user(mysql, name, passwd) == 0;
+}
+
+static void test_negative_expires(user_cache *cache)
+{
+    std::string name = test_name("ttl", 0);
+    bool used_db = false;
+    CHECK(cache->check(name, "pw", &used_db) == USER_ABSENT);
+    CHECK(used_db);
+
+    CHECK(insert_direct(name, "pw"));
+    //有效期内由反向缓存回答，不查库
+    used_db = false;
+    CHECK(cache->check(name, "pw", &used_db) == USER_ABSENT);
+    CHECK(!used_db);
+
+    sleep(NEGATIVE_TTL + 1);
+    used_db = false;
+    CHECK(cache->check(name, "pw", &used_db) == USER_OK);
+    CHECK(used_db);
+}
+
+static void test_register_then_login(user_cache *cache)
+{
+    for (int i = 0; i < 50; ++i)
+    {
+        std::string name = test_name("reg", i);
+        //先查一次，让用户名进入反向缓存
+        CHECK(cache->check(name, "pw") == USER_ABSENT);
+
+        std::atomic<bool> done(false);
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; ++t)
+        {
+            readers.emplace_back([&] {
+                while (!done.load(std::memory_order_acquire))
+                    cache->check(name, "pw");
+            });
+        }
+        CHECK(cache->add_user(name, "pw"));
+        done.store(true, std::memory_order_release);
+        for (auto &t : readers)
+            t.join();
+
+        CHECK(cache->check(name, "pw") == USER_OK);
+        CHECK(cache->check(name, "bad") == USER_WRONG_PASSWD);
+    }
+}
+
+static void cleanup()
+{
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, g_pool);
+    if (!mysql)
+        return;
+    for (size_t i = 0; i < g_names.size(); ++i)
+    {
+        std::string sql = "DELETE FROM user WHERE username='" + g_names[i] + "'";
+        mysql_query(mysql, sql.c_str());
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        fprintf(stderr, "usage: %s db_user db_passwd db_name [host]\n", argv[0]);
+        return 1;
+    }
+    g_pool = connection_pool::GetInstance();
+    g_pool->init(argc > 4 ? argv[4] : "localhost", argv[1], argv[2], argv[3], 3306, 8, 1);
+
+    //不使用布隆过滤器：直接写库的用户不在其中，会在反向缓存之前就被判为不存在
+    user_cache *cache = user_cache::get_instance();
+    cache->init(g_pool, 1, 65536, 8192, 0, NEGATIVE_TTL);
+
+    test_negative_expires(cache);
+    test_register_then_login(cache);
+    cleanup();
+
+    if (g_failed)
+    {
+        fprintf(stderr, "%d check(s) failed\n", g_failed);
+        return 1;
+    }
+    printf("user_cache_test passed\n");
+    return 0;
+}
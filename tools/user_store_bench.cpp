@@ -0,0 +1,141 @@
+//用户表的并发压测：登录(查找)和注册(插入)混合，对比 user_store 与原来的 std::map + 全局锁
+//编译：g++ -std=c++17 -O2 -pthread -o user_store_bench tools/user_store_bench.cpp http/user_store.cpp
+//用法：./user_store_bench [线程数=8] [每线程操作数=1000000] [注册占比%=5] [预置用户数=100000]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <map>
+#include <string>
+#include "../http/user_store.h"
+
+static int g_threads = 8;
+static long g_ops = 1000000;
+static int g_register_pct = 5;
+static long g_preload = 100000;
+
+//原来的做法；登录也加锁，否则是数据竞争
+struct map_store
+{
+    locker lock;
+    std::map<std::string, std::string, std::less<>> users;
+
+    bool insert(std::string_view name, std::string_view passwd)
+    {
+        lock.lock();
+        bool ok = users.emplace(std::string(name), std::string(passwd)).second;
+        lock.unlock();
+        return ok;
+    }
+    bool check(std::string_view name, std::string_view passwd)
+    {
+        lock.lock();
+        auto it = users.find(name);
+        bool ok = it != users.end() && it->second == passwd;
+        lock.unlock();
+        return ok;
+    }
+};
+
+static map_store *g_map;
+static user_store *g_store;
+
+struct worker_arg
+{
+    int id;
+    bool use_map;
+    long hits;
+};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *p)
+{
+    worker_arg *arg = (worker_arg *)p;
+    unsigned seed = arg->id * 7919 + 1;
+    char name[32], passwd[32];
+    long next_user = 0;
+    for (long i = 0; i < g_ops; ++i)
+    {
+        if ((long)(rand_r(&seed) % 100) < g_register_pct)
+        {
+            int n = snprintf(name, sizeof(name), "new_%d_%ld", arg->id, next_user++);
+            if (arg->use_map)
+                g_map->insert(std::string_view(name, n), "secret");
+            else
+                g_store->insert(std::string_view(name, n), "secret");
+        }
+        else
+        {
+            int n = snprintf(name, sizeof(name), "user%ld", (long)(rand_r(&seed) % g_preload));
+            int m = snprintf(passwd, sizeof(passwd), "pw%s", name + 4);
+            bool ok = arg->use_map ? g_map->check(std::string_view(name, n), std::string_view(passwd, m))
+                                   : g_store->check(std::string_view(name, n), std::string_view(passwd, m));
+            arg->hits += ok;
+        }
+    }
+    return NULL;
+}
+
+static void run(const char *label, bool use_map)
+{
+    pthread_t tid[256];
+    worker_arg args[256];
+    double start = now();
+    for (int i = 0; i < g_threads; ++i)
+    {
+        args[i].id = i;
+        args[i].use_map = use_map;
+        args[i].hits = 0;
+        pthread_create(&tid[i], NULL, worker, &args[i]);
+    }
+    long hits = 0;
+    for (int i = 0; i < g_threads; ++i)
+    {
+        pthread_join(tid[i], NULL);
+        hits += args[i].hits;
+    }
+    double sec = now() - start;
+    printf("%-12s %8.3fs  %10.0f ops/s  login hits %ld\n", label, sec, g_threads * g_ops / sec, hits);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        g_threads = atoi(argv[1]);
+    if (argc > 2)
+        g_ops = atol(argv[2]);
+    if (argc > 3)
+        g_register_pct = atoi(argv[3]);
+    if (argc > 4)
+        g_preload = atol(argv[4]);
+    if (g_threads < 1 || g_threads > 256 || g_preload < 1)
+    {
+        fprintf(stderr, "usage: %s [threads<=256] [ops] [register%%] [preload]\n", argv[0]);
+        return 1;
+    }
+
+    g_map = new map_store;
+    g_store = new user_store;
+    char name[32], passwd[32];
+    for (long i = 0; i < g_preload; ++i)
+    {
+        int n = snprintf(name, sizeof(name), "user%ld", i);
+        int m = snprintf(passwd, sizeof(passwd), "pw%ld", i);
+        g_map->insert(std::string_view(name, n), std::string_view(passwd, m));
+        g_store->insert(std::string_view(name, n), std::string_view(passwd, m));
+    }
+
+    printf("threads %d, ops/thread %ld, register %d%%, preload %ld\n", g_threads, g_ops, g_register_pct, g_preload);
+    run("map+locker", true);
+    run("user_store", false);
+    delete g_map;
+    delete g_store;
+    return 0;
+}